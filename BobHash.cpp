@@ -5,6 +5,12 @@
 
 #include "BobHash.hpp"
 #include <assert.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BOBHASH_AVX2
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -166,6 +172,49 @@ void BOBHash::initialize(uint primeNum) {
   this->primeNum = primeNum;
 }
 
+// The words added to a, b and c for the last (at most 11 byte) part of the key
+// (including the sign extension of `str[i]`). The length goes in c, whose
+// first byte is reserved for it.
+static inline void bob_tail(const char *str, uint len, uint *a, uint *b,
+                            uint *c) {
+  *a = *b = 0;
+  *c = len;
+  switch (len) {
+  case 11:
+    *c += ((uint)str[10] << 24);
+    // fall through
+  case 10:
+    *c += ((uint)str[9] << 16);
+    // fall through
+  case 9:
+    *c += ((uint)str[8] << 8);
+    // fall through
+  case 8:
+    *b += ((uint)str[7] << 24);
+    // fall through
+  case 7:
+    *b += ((uint)str[6] << 16);
+    // fall through
+  case 6:
+    *b += ((uint)str[5] << 8);
+    // fall through
+  case 5:
+    *b += str[4];
+    // fall through
+  case 4:
+    *a += ((uint)str[3] << 24);
+    // fall through
+  case 3:
+    *a += ((uint)str[2] << 16);
+    // fall through
+  case 2:
+    *a += ((uint)str[1] << 8);
+    // fall through
+  case 1:
+    *a += str[0];
+  }
+}
+
 uint BOBHash::run(const char *str, uint len) {
   // register ub4 a,b,c,len;
   uint a, b, c;
@@ -189,37 +238,163 @@ uint BOBHash::run(const char *str, uint len) {
   }
 
   /*------------------------------------- handle the last 11 bytes */
-  c += len;
-  switch (len) /* all the case statements fall through */
-  {
-  case 11:
-    c += ((uint)str[10] << 24);
-  case 10:
-    c += ((uint)str[9] << 16);
-  case 9:
-    c += ((uint)str[8] << 8);
-    /* the first byte of c is reserved for the length */
-  case 8:
-    b += ((uint)str[7] << 24);
-  case 7:
-    b += ((uint)str[6] << 16);
-  case 6:
-    b += ((uint)str[5] << 8);
-  case 5:
-    b += str[4];
-  case 4:
-    a += ((uint)str[3] << 24);
-  case 3:
-    a += ((uint)str[2] << 16);
-  case 2:
-    a += ((uint)str[1] << 8);
-  case 1:
-    a += str[0];
-    /* case 0: nothing left to add */
-  }
+  uint ka, kb, kc;
+  bob_tail(str, len, &ka, &kb, &kc);
+  a += ka;
+  b += kb;
+  c += kc;
   mix(a, b, c);
   /*-------------------------------------------- report the result */
   return c;
 }
 
 BOBHash::~BOBHash() {}
+
+static inline void bob_block(const char *str, uint *a, uint *b, uint *c) {
+  *a = (str[0] + ((uint)str[1] << 8) + ((uint)str[2] << 16) +
+        ((uint)str[3] << 24));
+  *b = (str[4] + ((uint)str[5] << 8) + ((uint)str[6] << 16) +
+        ((uint)str[7] << 24));
+  *c = (str[8] + ((uint)str[9] << 8) + ((uint)str[10] << 16) +
+        ((uint)str[11] << 24));
+}
+
+static void bobhash_multi_scalar(const uint *seeds, const char *str, uint len,
+                                 uint *out, int count) {
+  for (int i = 0; i < count; i++) {
+    uint a, b, c;
+    uint ka, kb, kc;
+    const char *key = str;
+    uint remaining = len;
+
+    a = b = 0x9e3779b9;
+    c = seeds[i];
+
+    while (remaining >= 12) {
+      bob_block(key, &ka, &kb, &kc);
+      a += ka;
+      b += kb;
+      c += kc;
+      mix(a, b, c);
+      key += 12;
+      remaining -= 12;
+    }
+
+    bob_tail(key, remaining, &ka, &kb, &kc);
+    a += ka;
+    b += kb;
+    c += kc;
+    mix(a, b, c);
+    out[i] = c;
+  }
+}
+
+#ifdef BOBHASH_AVX2
+
+#define mix_avx2(a, b, c)                                                      \
+  {                                                                            \
+    a = _mm256_sub_epi32(_mm256_sub_epi32(a, b), c);                           \
+    a = _mm256_xor_si256(a, _mm256_srli_epi32(c, 13));                         \
+    b = _mm256_sub_epi32(_mm256_sub_epi32(b, c), a);                           \
+    b = _mm256_xor_si256(b, _mm256_slli_epi32(a, 8));                          \
+    c = _mm256_sub_epi32(_mm256_sub_epi32(c, a), b);                           \
+    c = _mm256_xor_si256(c, _mm256_srli_epi32(b, 13));                         \
+    a = _mm256_sub_epi32(_mm256_sub_epi32(a, b), c);                           \
+    a = _mm256_xor_si256(a, _mm256_srli_epi32(c, 12));                         \
+    b = _mm256_sub_epi32(_mm256_sub_epi32(b, c), a);                           \
+    b = _mm256_xor_si256(b, _mm256_slli_epi32(a, 16));                         \
+    c = _mm256_sub_epi32(_mm256_sub_epi32(c, a), b);                           \
+    c = _mm256_xor_si256(c, _mm256_srli_epi32(b, 5));                          \
+    a = _mm256_sub_epi32(_mm256_sub_epi32(a, b), c);                           \
+    a = _mm256_xor_si256(a, _mm256_srli_epi32(c, 3));                          \
+    b = _mm256_sub_epi32(_mm256_sub_epi32(b, c), a);                           \
+    b = _mm256_xor_si256(b, _mm256_slli_epi32(a, 10));                         \
+    c = _mm256_sub_epi32(_mm256_sub_epi32(c, a), b);                           \
+    c = _mm256_xor_si256(c, _mm256_srli_epi32(b, 15));                         \
+  }
+
+// Each lane runs the same key with a different seed. Only the initial value of
+// c differs between the lanes, so the key words are computed once and
+// broadcast.
+__attribute__((target("avx2"))) static void
+bobhash_multi_avx2(const uint *seeds, const char *str, uint len, uint *out,
+                   int count) {
+  uint ka, kb, kc;
+  uint tail_a, tail_b, tail_c;
+  const char *key = str;
+  uint remaining = len;
+
+  while (remaining >= 12) {
+    key += 12;
+    remaining -= 12;
+  }
+  bob_tail(key, remaining, &tail_a, &tail_b, &tail_c);
+
+  for (int i = 0; i < count; i += 8) {
+    __m256i a = _mm256_set1_epi32(0x9e3779b9);
+    __m256i b = a;
+    __m256i c = _mm256_loadu_si256((const __m256i *)(seeds + i));
+
+    key = str;
+    remaining = len;
+    while (remaining >= 12) {
+      bob_block(key, &ka, &kb, &kc);
+      a = _mm256_add_epi32(a, _mm256_set1_epi32(ka));
+      b = _mm256_add_epi32(b, _mm256_set1_epi32(kb));
+      c = _mm256_add_epi32(c, _mm256_set1_epi32(kc));
+      mix_avx2(a, b, c);
+      key += 12;
+      remaining -= 12;
+    }
+
+    a = _mm256_add_epi32(a, _mm256_set1_epi32(tail_a));
+    b = _mm256_add_epi32(b, _mm256_set1_epi32(tail_b));
+    c = _mm256_add_epi32(c, _mm256_set1_epi32(tail_c));
+    mix_avx2(a, b, c);
+
+    if (count - i >= 8) {
+      _mm256_storeu_si256((__m256i *)(out + i), c);
+    } else {
+      uint lanes[8];
+      _mm256_storeu_si256((__m256i *)lanes, c);
+      memcpy(out + i, lanes, sizeof(uint) * (count - i));
+    }
+  }
+}
+
+static bool bobhash_use_avx2() {
+  static bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+
+#endif
+
+BOBHashMulti::BOBHashMulti() {
+  this->count = 0;
+  this->seeds = nullptr;
+}
+
+BOBHashMulti::~BOBHashMulti() { delete[] seeds; }
+
+void BOBHashMulti::initialize(const BOBHash *hashers, int count) {
+  this->count = count;
+
+  delete[] seeds;
+  int padded = (count + 7) / 8 * 8;
+  seeds = new uint[padded]();
+
+  for (int i = 0; i < count; i++) {
+    seeds[i] = prime[hashers[i].primeNum];
+  }
+}
+
+void BOBHashMulti::run(const char *str, uint len, uint *out, int count) {
+  assert(count <= this->count && "BOBHashMulti: more hashes than seeds!");
+#ifdef BOBHASH_AVX2
+  if (bobhash_use_avx2()) {
+    bobhash_multi_avx2(seeds, str, len, out, count);
+    return;
+  }
+#endif
+  bobhash_multi_scalar(seeds, str, len, out, count);
+}
@@ -27,4 +27,25 @@ public:
 private:
 };
 
+/// Runs several BOBHash seeds over the same key at once. The key is only read
+/// once and, when the CPU supports AVX2, the Bob `mix` runs for 8 seeds in
+/// parallel SIMD lanes. The output is identical to calling `run` on each of the
+/// hashers.
+class BOBHashMulti {
+
+public:
+  BOBHashMulti();
+  ~BOBHashMulti();
+  void initialize(const BOBHash *hashers, int count);
+  // Writes the hashes of the first `count` seeds to `out`.
+  void run(const char *str, uint len, uint *out, int count);
+
+  int count;
+
+private:
+  // The initial value of `c` (the seed's prime) for each hasher, padded with
+  // zeros up to a multiple of 8.
+  uint *seeds;
+};
+
 #endif // !BOB_HASH_H
@@ -3,6 +3,7 @@
 // Specifically the CountMinBaseline comes from SALSA with the other sketches
 // being adaptations of that.
 
+#include <algorithm>
 #include <assert.h>
 #include <chrono>
 #include <fstream>
@@ -15,20 +16,131 @@
 
 #include "CMS.hpp"
 #include "skew_estimation.hpp"
+#include "xxhash.h"
 
 using namespace std;
 
+std::string index_mode_name(IndexMode mode) {
+  switch (mode) {
+  case per_row_hash:
+    return "per row hash";
+  case double_hashing:
+    return "double hashing";
+  }
+  throw std::runtime_error("invalid index mode");
+}
+
+uint32_t family_seed(SeedFamily family, int seed, int i) {
+  if (family == flat_seeds) {
+    return (seed * (3 + i) + i + 100) % 1229;
+  }
+  return seed * (7 + i) + i + 100;
+}
+
+HashCache::HashCache() {
+  this->packet = nullptr;
+  this->hashes = nullptr;
+}
+
+HashCache::~HashCache() { delete[] hashes; }
+
+void HashCache::initialize(int seed, int max_hash_count,
+                           HashFamily hash_family) {
+  this->seed = seed;
+  this->max_hash_count = max_hash_count;
+  this->hash_family = hash_family;
+
+  delete[] hashes;
+  hashes = new uint[SEED_FAMILY_COUNT * max_hash_count];
+
+  uint32_t *seeds = new uint32_t[max_hash_count];
+  for (int f = 0; f < SEED_FAMILY_COUNT; ++f) {
+    for (int i = 0; i < max_hash_count; ++i) {
+      seeds[i] = family_seed((SeedFamily)f, seed, i);
+    }
+    hashers[f].initialize(hash_family, seeds, max_hash_count);
+  }
+  delete[] seeds;
+
+  set_packet(nullptr);
+}
+
+void HashCache::set_packet(const char *str) {
+  this->packet = str;
+  for (int f = 0; f < SEED_FAMILY_COUNT; ++f) {
+    computed[f] = false;
+  }
+}
+
+const uint *HashCache::get(SeedFamily family, int seed, HashFamily hash_family,
+                           int hash_count) {
+  assert(packet != nullptr && "HashCache: no packet set!");
+  assert(seed == this->seed && hash_family == this->hash_family &&
+         "HashCache: the sketch uses different hash functions!");
+  assert(hash_count <= max_hash_count && "HashCache: too many hashes!");
+
+  uint *family_hashes = hashes + family * max_hash_count;
+  if (!computed[family]) {
+    hashers[family].run(packet, family_hashes, max_hash_count);
+    computed[family] = true;
+  }
+  return family_hashes;
+}
+
+// Writes the `hash_count` counter indexes of `str` into `indexes`.
+//
+// With `double_hashing` the indexes are h1 + i * h2 where h1 and h2 are the two
+// halves of a single XXH3 hash. h2 is forced to be odd so that for a power of 2
+// width the indexes of one packet are all distinct.
+static inline void flat_indexes(const char *str, IndexMode mode,
+                                uint64_t index_seed, PacketHasher *hasher,
+                                int hash_count, int width_mask,
+                                uint *indexes) {
+  if (mode == double_hashing) {
+    uint64_t hash = XXH3_64bits_withSeed(str, FT_SIZE, index_seed);
+    uint h1 = (uint)hash;
+    uint h2 = (uint)(hash >> 32) | 1;
+    for (int i = 0; i < hash_count; ++i) {
+      indexes[i] = (h1 + (uint)i * h2) & width_mask;
+    }
+  } else {
+    hasher->run(str, indexes, hash_count);
+    for (int i = 0; i < hash_count; ++i) {
+      indexes[i] &= width_mask;
+    }
+  }
+}
+
+// Conservative update: only the counters below the packet's new estimate (its
+// current minimum + 1) are raised to it. Returns the new estimate.
+static inline uint32_t conservative_update(uint32_t *counters,
+                                           const uint *indexes,
+                                           int hash_count) {
+  uint32_t min = UINT32_MAX;
+  for (int i = 0; i < hash_count; ++i) {
+    if (counters[indexes[i]] < min) {
+      min = counters[indexes[i]];
+    }
+  }
+
+  uint32_t estimate = min + 1;
+  for (int i = 0; i < hash_count; ++i) {
+    if (counters[indexes[i]] < estimate) {
+      counters[indexes[i]] = estimate;
+    }
+  }
+  return estimate;
+}
+
 CountMinBaseline::CountMinBaseline() {}
 
 CountMinBaseline::~CountMinBaseline() {
-  for (int i = 0; i < height; ++i) {
-    delete[] baseline_cms[i];
-  }
-  delete[] bobhash;
+  delete[] hashes;
   delete[] baseline_cms;
 }
 
-void CountMinBaseline::initialize(int width, int height, int seed) {
+void CountMinBaseline::initialize(int width, int height, int seed,
+                                  PageMode page_mode, HashFamily hash_family) {
   this->width = width;
   this->height = height;
 
@@ -38,28 +150,60 @@ void CountMinBaseline::initialize(int width, int height, int seed) {
   assert(width % 4 == 0 && "We assume that (w % 4 == 0)!");
   assert((width & (width - 1)) == 0 && "We assume that width is a power of 2!");
 
+  // All the rows share one allocation, `baseline_cms` only points into it.
+  counters = storage.allocate((size_t)width * height, page_mode);
   baseline_cms = new uint32_t *[height];
-  bobhash = new BOBHash[height];
+  uint32_t *seeds = new uint32_t[height];
 
   for (int i = 0; i < height; ++i) {
-    baseline_cms[i] = new uint32_t[width]();
-    bobhash[i].initialize(seed * (7 + i) + i + 100);
+    baseline_cms[i] = counters + (size_t)i * width;
+    seeds[i] = family_seed(row_seeds, seed, i);
   }
+  hasher.initialize(hash_family, seeds, height);
+  delete[] seeds;
+  hashes = new uint[INCREMENT_BATCH * height];
 }
 
 void CountMinBaseline::increment(const char *str) {
+  hasher.run(str, hashes, height);
   for (int i = 0; i < height; ++i) {
-    uint index = (bobhash[i].run(str, FT_SIZE)) & width_mask;
-    ++baseline_cms[i][index];
+    uint index = i * width + (hashes[i] & width_mask);
+    ++counters[index];
+  }
+}
+
+void CountMinBaseline::increment_batch(const char *packets, size_t n) {
+  for (size_t start = 0; start < n; start += INCREMENT_BATCH) {
+    size_t block = min(n - start, (size_t)INCREMENT_BATCH);
+    const char *block_packets = packets + start * FT_SIZE;
+
+    // Hash the whole block and prefetch every counter it touches before
+    // incrementing so that the cache misses overlap.
+    for (size_t j = 0; j < block; ++j) {
+      uint *packet_indexes = hashes + j * height;
+      hasher.run(block_packets + j * FT_SIZE, packet_indexes, height);
+      for (int i = 0; i < height; ++i) {
+        packet_indexes[i] = i * width + (packet_indexes[i] & width_mask);
+        __builtin_prefetch(&counters[packet_indexes[i]], 1);
+      }
+    }
+
+    for (size_t j = 0; j < block; ++j) {
+      uint *packet_indexes = hashes + j * height;
+      for (int i = 0; i < height; ++i) {
+        ++counters[packet_indexes[i]];
+      }
+    }
   }
 }
 
 uint64_t CountMinBaseline::query(const char *str) {
-  uint index = (bobhash[0].run(str, FT_SIZE)) & width_mask;
-  uint64_t min = baseline_cms[0][index];
+  hasher.run(str, hashes, height);
+  uint index = hashes[0] & width_mask;
+  uint64_t min = counters[index];
   for (int i = 1; i < height; ++i) {
-    uint index = (bobhash[i].run(str, FT_SIZE)) & width_mask;
-    uint64_t temp = baseline_cms[i][index];
+    uint index = i * width + (hashes[i] & width_mask);
+    uint64_t temp = counters[index];
     if (min > temp) {
       min = temp;
     }
@@ -69,8 +213,9 @@ uint64_t CountMinBaseline::query(const char *str) {
 
 void CountMinBaseline::print_indexes(const char *str) {
   printf("H = [");
+  hasher.run(str, hashes, height);
   for (int i = 0; i < height; ++i) {
-    uint index = (bobhash[i].run(str, FT_SIZE)) & width_mask;
+    uint index = hashes[i] & width_mask;
     if (i == 0) {
       printf("%i", index);
     } else {
@@ -83,42 +228,71 @@ void CountMinBaseline::print_indexes(const char *str) {
 CountMinBaselineFlexibleWidth::CountMinBaselineFlexibleWidth() {}
 
 CountMinBaselineFlexibleWidth::~CountMinBaselineFlexibleWidth() {
-  for (int i = 0; i < height; ++i) {
-    delete[] baseline_cms[i];
-  }
-  delete[] bobhash;
+  delete[] hashes;
   delete[] baseline_cms;
 }
 
-void CountMinBaselineFlexibleWidth::initialize(int width, int height,
-                                               int seed) {
+void CountMinBaselineFlexibleWidth::initialize(int width, int height, int seed,
+                                               PageMode page_mode,
+                                               HashFamily hash_family) {
   this->width = width;
   this->height = height;
 
   assert(width > 0 && "width is greater than 0");
 
+  // All the rows share one allocation, `baseline_cms` only points into it.
+  counters = storage.allocate((size_t)width * height, page_mode);
   baseline_cms = new uint32_t *[height];
-  bobhash = new BOBHash[height];
+  uint32_t *seeds = new uint32_t[height];
 
   for (int i = 0; i < height; ++i) {
-    baseline_cms[i] = new uint32_t[width]();
-    bobhash[i].initialize(seed * (7 + i) + i + 100);
+    baseline_cms[i] = counters + (size_t)i * width;
+    seeds[i] = family_seed(row_seeds, seed, i);
   }
+  hasher.initialize(hash_family, seeds, height);
+  delete[] seeds;
+  hashes = new uint[INCREMENT_BATCH * height];
 }
 
 void CountMinBaselineFlexibleWidth::increment(const char *str) {
+  hasher.run(str, hashes, height);
   for (int i = 0; i < height; ++i) {
-    uint index = (bobhash[i].run(str, FT_SIZE)) % width;
-    ++baseline_cms[i][index];
+    uint index = i * width + hashes[i] % width;
+    ++counters[index];
+  }
+}
+
+void CountMinBaselineFlexibleWidth::increment_batch(const char *packets,
+                                                    size_t n) {
+  for (size_t start = 0; start < n; start += INCREMENT_BATCH) {
+    size_t block = min(n - start, (size_t)INCREMENT_BATCH);
+    const char *block_packets = packets + start * FT_SIZE;
+
+    for (size_t j = 0; j < block; ++j) {
+      uint *packet_indexes = hashes + j * height;
+      hasher.run(block_packets + j * FT_SIZE, packet_indexes, height);
+      for (int i = 0; i < height; ++i) {
+        packet_indexes[i] = i * width + packet_indexes[i] % width;
+        __builtin_prefetch(&counters[packet_indexes[i]], 1);
+      }
+    }
+
+    for (size_t j = 0; j < block; ++j) {
+      uint *packet_indexes = hashes + j * height;
+      for (int i = 0; i < height; ++i) {
+        ++counters[packet_indexes[i]];
+      }
+    }
   }
 }
 
 uint64_t CountMinBaselineFlexibleWidth::query(const char *str) {
-  uint index = (bobhash[0].run(str, FT_SIZE)) % width;
-  uint64_t min = baseline_cms[0][index];
+  hasher.run(str, hashes, height);
+  uint index = hashes[0] % width;
+  uint64_t min = counters[index];
   for (int i = 1; i < height; ++i) {
-    uint index = (bobhash[i].run(str, FT_SIZE)) % width;
-    uint64_t temp = baseline_cms[i][index];
+    uint index = i * width + hashes[i] % width;
+    uint64_t temp = counters[index];
     if (min > temp) {
       min = temp;
     }
@@ -126,17 +300,27 @@ uint64_t CountMinBaselineFlexibleWidth::query(const char *str) {
   return min;
 }
 
-CountMinFlat::CountMinFlat(int k) { this->topK = new TopK(k); }
+CountMinFlat::CountMinFlat(int k, HeavyHitterMode heavy_hitters)
+    : CountMinFlat(k, heavy_hitters, false) {}
+
+CountMinFlat::CountMinFlat(int k, HeavyHitterMode heavy_hitters,
+                           bool conservative) {
+  this->topK = make_heavy_hitters(heavy_hitters, k);
+  this->conservative = conservative;
+}
 
 CountMinFlat::~CountMinFlat() {
-  delete[] flat_cms;
-  delete[] bobhash;
+  delete[] indexes;
 }
 
-void CountMinFlat::initialize(int width, int hash_count, int seed) {
+void CountMinFlat::initialize(int width, int hash_count, int seed,
+                              IndexMode index_mode, PageMode page_mode,
+                              HashFamily hash_family) {
   this->width = width;
   this->hash_count = hash_count;
   this->counter = 0;
+  this->index_mode = index_mode;
+  this->index_seed = seed;
 
   width_mask = width - 1;
 
@@ -144,32 +328,91 @@ void CountMinFlat::initialize(int width, int hash_count, int seed) {
   assert(width % 4 == 0 && "We assume that (w % 4 == 0)!");
   assert((width & (width - 1)) == 0 && "We assume that width is a power of 2!");
 
-  flat_cms = new uint32_t[width];
-  bobhash = new BOBHash[hash_count];
+  flat_cms = storage.allocate(width, page_mode);
+  uint32_t *seeds = new uint32_t[hash_count];
+  indexes = new uint[INCREMENT_BATCH * hash_count];
 
   for (int i = 0; i < hash_count; ++i) {
-    bobhash[i].initialize((seed * (3 + i) + i + 100) % 1229);
+    seeds[i] = family_seed(flat_seeds, seed, i);
   }
+  hasher.initialize(hash_family, seeds, hash_count);
+  delete[] seeds;
 }
 
 void CountMinFlat::increment(const char *str) {
+  flat_indexes(str, index_mode, index_seed, &hasher, hash_count,
+               width_mask, indexes);
+  increment_indexes(str, indexes);
+}
+
+void CountMinFlat::increment_indexes(const char *str, const uint *indexes) {
   uint32_t min = UINT32_MAX;
-  for (int i = 0; i < hash_count; ++i) {
-    uint index = (bobhash[i].run(str, FT_SIZE)) & width_mask;
-    uint32_t val = ++flat_cms[index];
-    if (val < min) {
-      min = val;
+  if (this->conservative) {
+    min = conservative_update(flat_cms, indexes, hash_count);
+  } else {
+    for (int i = 0; i < hash_count; ++i) {
+      uint32_t val = ++flat_cms[indexes[i]];
+      if (val < min) {
+        min = val;
+      }
     }
   }
   this->counter++;
   this->topK->update(str, min);
 }
 
+void CountMinFlat::increment_batch(const char *packets, size_t n) {
+  for (size_t start = 0; start < n; start += INCREMENT_BATCH) {
+    size_t block = min(n - start, (size_t)INCREMENT_BATCH);
+    const char *block_packets = packets + start * FT_SIZE;
+
+    for (size_t j = 0; j < block; ++j) {
+      uint *packet_indexes = indexes + j * hash_count;
+      flat_indexes(block_packets + j * FT_SIZE, index_mode, index_seed,
+                   &hasher, hash_count, width_mask, packet_indexes);
+      for (int i = 0; i < hash_count; ++i) {
+        __builtin_prefetch(&flat_cms[packet_indexes[i]], 1);
+      }
+    }
+
+    for (size_t j = 0; j < block; ++j) {
+      increment_indexes(block_packets + j * FT_SIZE,
+                        indexes + j * hash_count);
+    }
+  }
+}
+
 uint64_t CountMinFlat::query(const char *str) {
+  flat_indexes(str, index_mode, index_seed, &hasher, hash_count,
+               width_mask, indexes);
+  return query_indexes(indexes);
+}
+
+uint64_t CountMinFlat::increment_and_query(const char *str) {
+  flat_indexes(str, index_mode, index_seed, &hasher, hash_count,
+               width_mask, indexes);
+  increment_indexes(str, indexes);
+  return query_indexes(indexes);
+}
+
+uint64_t CountMinFlat::increment_and_query(const char *str, HashCache *cache) {
+  if (index_mode == double_hashing) {
+    return increment_and_query(str);
+  }
+
+  const uint *hashes =
+      cache->get(flat_seeds, index_seed, hasher.get_family(), hash_count);
+  for (int i = 0; i < hash_count; ++i) {
+    indexes[i] = hashes[i] & width_mask;
+  }
+  increment_indexes(str, indexes);
+  return query_indexes(indexes);
+}
+
+uint64_t CountMinFlat::query_indexes(const uint *indexes) {
   uint64_t min = UINT64_MAX;
   for (int i = 0; i < hash_count; ++i) {
-    uint index = (bobhash[i].run(str, FT_SIZE)) & width_mask;
-    uint64_t temp = flat_cms[index];
+    uint64_t temp = flat_cms[indexes[i]];
     if (min > temp) {
       min = temp;
     }
@@ -178,14 +421,12 @@ uint64_t CountMinFlat::query(const char *str) {
 }
 
 double CountMinFlat::estimate_skew() {
-  auto items = this->topK->items();
-  return small_set_estimate_skew(this->counter, items.size(), items.begin(),
-                                 items.end());
+  return estimate_topk_skew(this->skew_estimator, this->counter, *this->topK);
 }
 
 double CountMinFlat::sketch_error(double alpha, long total, int mem) {
 
-  int threshold = (int)(alpha * (double)total / (double)mem);
+  uint32_t threshold = (uint32_t)(alpha * (double)total / (double)mem);
   int above_threshold = 0;
 
   for (int counter = 0; counter < width; counter++) {
@@ -200,38 +441,55 @@ double CountMinFlat::sketch_error(double alpha, long total, int mem) {
 
 int CountMinFlat::get_hash_function_count() { return this->hash_count; }
 
-CountMinTopK::CountMinTopK(int k) { this->topK = new TopK(k); }
+CountMinTopK::CountMinTopK(int k, HeavyHitterMode heavy_hitters) {
+  this->topK = make_heavy_hitters(heavy_hitters, k);
+}
 
 CountMinTopK::~CountMinTopK() {
-  for (int i = 0; i < height; ++i) {
-    delete[] baseline_cms[i];
-  }
-  delete[] bobhash;
+  delete[] hashes;
   delete[] baseline_cms;
 }
 
-void CountMinTopK::initialize(int width, int height, int seed) {
+void CountMinTopK::initialize(int width, int height, int seed,
+                              PageMode page_mode, HashFamily hash_family) {
   this->width = width;
   this->height = height;
+  this->seed = seed;
 
   assert(width > 0 && "We assume too much!");
 
+  // All the rows share one allocation, `baseline_cms` only points into it.
+  counters = storage.allocate((size_t)width * height, page_mode);
   baseline_cms = new uint32_t *[height];
-  bobhash = new BOBHash[height];
+  uint32_t *seeds = new uint32_t[height];
+
+  for (int i = 0; i < height; ++i) {
+    baseline_cms[i] = counters + (size_t)i * width;
+    seeds[i] = family_seed(row_seeds, seed, i);
+  }
+  hasher.initialize(hash_family, seeds, height);
+  delete[] seeds;
+  hashes = new uint[INCREMENT_BATCH * height];
+}
 
+// Writes the offset of the packet's counter in every row into `indexes`.
+void CountMinTopK::row_indexes(const char *str, uint *indexes) {
+  hasher.run(str, indexes, height);
   for (int i = 0; i < height; ++i) {
-    baseline_cms[i] = new uint32_t[width]();
-    bobhash[i].initialize(seed * (7 + i) + i + 100);
+    indexes[i] = i * width + indexes[i] % width;
   }
 }
 
 void CountMinTopK::increment(const char *str) {
-  uint index = (bobhash[0].run(str, FT_SIZE)) % width;
-  uint64_t min = baseline_cms[0][index];
+  row_indexes(str, hashes);
+  increment_indexes(str, hashes);
+}
+
+void CountMinTopK::increment_indexes(const char *str, const uint *indexes) {
+  uint64_t min = counters[indexes[0]];
 
   for (int i = 0; i < height; ++i) {
-    uint index = (bobhash[i].run(str, FT_SIZE)) % width;
-    uint64_t temp = ++baseline_cms[i][index];
+    uint64_t temp = ++counters[indexes[i]];
     if (min > temp) {
       min = temp;
     }
@@ -241,12 +499,50 @@ void CountMinTopK::increment(const char *str) {
   this->topK->update(str, min);
 }
 
+void CountMinTopK::increment_batch(const char *packets, size_t n) {
+  for (size_t start = 0; start < n; start += INCREMENT_BATCH) {
+    size_t block = min(n - start, (size_t)INCREMENT_BATCH);
+    const char *block_packets = packets + start * FT_SIZE;
+
+    for (size_t j = 0; j < block; ++j) {
+      uint *packet_indexes = hashes + j * height;
+      row_indexes(block_packets + j * FT_SIZE, packet_indexes);
+      for (int i = 0; i < height; ++i) {
+        __builtin_prefetch(&counters[packet_indexes[i]], 1);
+      }
+    }
+
+    for (size_t j = 0; j < block; ++j) {
+      increment_indexes(block_packets + j * FT_SIZE, hashes + j * height);
+    }
+  }
+}
+
 uint64_t CountMinTopK::query(const char *str) {
-  uint index = (bobhash[0].run(str, FT_SIZE)) % width;
-  uint64_t min = baseline_cms[0][index];
+  row_indexes(str, hashes);
+  return query_indexes(hashes);
+}
+
+uint64_t CountMinTopK::increment_and_query(const char *str) {
+  row_indexes(str, hashes);
+  increment_indexes(str, hashes);
+  return query_indexes(hashes);
+}
+
+uint64_t CountMinTopK::increment_and_query(const char *str, HashCache *cache) {
+  const uint *row_hashes =
+      cache->get(row_seeds, seed, hasher.get_family(), height);
+  for (int i = 0; i < height; ++i) {
+    hashes[i] = i * width + row_hashes[i] % width;
+  }
+  increment_indexes(str, hashes);
+  return query_indexes(hashes);
+}
+
+uint64_t CountMinTopK::query_indexes(const uint *indexes) {
+  uint64_t min = counters[indexes[0]];
   for (int i = 1; i < height; ++i) {
-    uint index = (bobhash[i].run(str, FT_SIZE)) % width;
-    uint64_t temp = baseline_cms[i][index];
+    uint64_t temp = counters[indexes[i]];
     if (min > temp) {
       min = temp;
     }
@@ -275,14 +571,13 @@ double CountMinTopK::sketch_error(double alpha, long total, int mem) {
 }
 
 double CountMinTopK::estimate_skew() {
-  auto items = this->topK->items();
-  return small_set_estimate_skew(this->counter, items.size(), items.begin(),
-                                 items.end());
+  return estimate_topk_skew(this->skew_estimator, this->counter, *this->topK);
 }
 void CountMinTopK::print_indexes(const char *str) {
   printf("H = [");
+  hasher.run(str, hashes, height);
   for (int i = 0; i < height; ++i) {
-    uint index = (bobhash[i].run(str, FT_SIZE)) % width;
+    uint index = hashes[i] % width;
     if (i == 0) {
       printf("%i", index);
     } else {
@@ -294,21 +589,190 @@ void CountMinTopK::print_indexes(const char *str) {
 
 int CountMinTopK::get_hash_function_count() { return this->height; }
 
-DynamicCountMin::DynamicCountMin(int k, ErrorMetric metric, bool use_bounds) {
-  this->topK = new TopK(k);
+CountMinBlocked::CountMinBlocked(int k, HeavyHitterMode heavy_hitters) {
+  this->topK = make_heavy_hitters(heavy_hitters, k);
+}
+
+CountMinBlocked::~CountMinBlocked() {
+  delete[] indexes;
+}
+
+void CountMinBlocked::initialize(int width, int hash_count, int seed,
+                                 PageMode page_mode, HashFamily hash_family) {
+  this->width = width;
+  this->hash_count = hash_count;
+  this->counter = 0;
+  this->seed = seed;
+
+  block_mask = width / BLOCK_COUNTERS - 1;
+
+  assert(width >= BLOCK_COUNTERS && "We assume at least one block!");
+  assert(hash_count <= BLOCK_COUNTERS && "At most one hash per counter!");
+  assert((width & (width - 1)) == 0 && "We assume that width is a power of 2!");
+
+  // The storage is 64 byte aligned so every block is exactly one cache line.
+  flat_cms = storage.allocate(width, page_mode);
+
+  uint32_t *seeds = new uint32_t[hash_count];
+  indexes = new uint[INCREMENT_BATCH * hash_count];
+
+  for (int i = 0; i < hash_count; ++i) {
+    seeds[i] = family_seed(flat_seeds, seed, i);
+  }
+  hasher.initialize(hash_family, seeds, hash_count);
+  delete[] seeds;
+}
+
+// The low bits of the first hash pick the block, the top 4 bits of every hash
+// pick a counter within the block.
+//
+// Unlike the flat sketch a packet's counters are drawn from only 16, so equal
+// offsets are common (and would count the packet twice in one counter). They
+// are made distinct by moving on to the next free counter in the block.
+void CountMinBlocked::blocked_indexes(const char *str, uint *indexes) {
+  hasher.run(str, indexes, hash_count);
+  block_offsets(indexes, indexes);
+}
+
+// Turns the raw `hashes` of a packet into its counter indexes (`hashes` and
+// `indexes` may be the same array).
+void CountMinBlocked::block_offsets(const uint *hashes, uint *indexes) {
+  uint block = (hashes[0] & block_mask) * BLOCK_COUNTERS;
+  uint used = 0;
+  for (int i = 0; i < hash_count; ++i) {
+    uint offset = hashes[i] >> 28;
+    while (used & (1u << offset)) {
+      offset = (offset + 1) & (BLOCK_COUNTERS - 1);
+    }
+    used |= 1u << offset;
+    indexes[i] = block + offset;
+  }
+}
+
+void CountMinBlocked::increment(const char *str) {
+  blocked_indexes(str, indexes);
+  increment_indexes(str, indexes);
+}
+
+void CountMinBlocked::increment_indexes(const char *str, const uint *indexes) {
+  uint32_t min = UINT32_MAX;
+  for (int i = 0; i < hash_count; ++i) {
+    uint32_t val = ++flat_cms[indexes[i]];
+    if (val < min) {
+      min = val;
+    }
+  }
+  this->counter++;
+  this->topK->update(str, min);
+}
+
+void CountMinBlocked::increment_batch(const char *packets, size_t n) {
+  for (size_t start = 0; start < n; start += INCREMENT_BATCH) {
+    size_t block = min(n - start, (size_t)INCREMENT_BATCH);
+    const char *block_packets = packets + start * FT_SIZE;
+
+    // Every counter of a packet is in the same line so one prefetch suffices.
+    for (size_t j = 0; j < block; ++j) {
+      uint *packet_indexes = indexes + j * hash_count;
+      blocked_indexes(block_packets + j * FT_SIZE, packet_indexes);
+      __builtin_prefetch(&flat_cms[packet_indexes[0]], 1);
+    }
+
+    for (size_t j = 0; j < block; ++j) {
+      increment_indexes(block_packets + j * FT_SIZE,
+                        indexes + j * hash_count);
+    }
+  }
+}
+
+uint64_t CountMinBlocked::query(const char *str) {
+  blocked_indexes(str, indexes);
+  return query_indexes(indexes);
+}
+
+uint64_t CountMinBlocked::increment_and_query(const char *str) {
+  blocked_indexes(str, indexes);
+  increment_indexes(str, indexes);
+  return query_indexes(indexes);
+}
+
+uint64_t CountMinBlocked::increment_and_query(const char *str,
+                                              HashCache *cache) {
+  block_offsets(cache->get(flat_seeds, seed, hasher.get_family(), hash_count),
+                indexes);
+  increment_indexes(str, indexes);
+  return query_indexes(indexes);
+}
+
+uint64_t CountMinBlocked::query_indexes(const uint *indexes) {
+  uint64_t min = UINT64_MAX;
+  for (int i = 0; i < hash_count; ++i) {
+    uint64_t temp = flat_cms[indexes[i]];
+    if (min > temp) {
+      min = temp;
+    }
+  }
+  return min;
+}
+
+double CountMinBlocked::estimate_skew() {
+  return estimate_topk_skew(this->skew_estimator, this->counter, *this->topK);
+}
+
+double CountMinBlocked::sketch_error(double alpha, long total, int mem) {
+
+  uint32_t threshold = (uint32_t)(alpha * (double)total / (double)mem);
+  int above_threshold = 0;
+
+  for (int counter = 0; counter < width; counter++) {
+    if (this->flat_cms[counter] > threshold) {
+      above_threshold++;
+    }
+  }
+
+  double failure_prob = (double)above_threshold / (double)width;
+  return failure_prob;
+}
+
+int CountMinBlocked::get_hash_function_count() { return this->hash_count; }
+
+CountMinConservative::CountMinConservative(int k,
+                                           HeavyHitterMode heavy_hitters)
+    : CountMinFlat(k, heavy_hitters, true) {}
+
+DynamicCountMin::DynamicCountMin(int k, ErrorMetric metric, bool use_bounds,
+                                 bool conservative,
+                                 HeavyHitterMode heavy_hitters) {
+  this->topK = make_heavy_hitters(heavy_hitters, k);
   this->optimisation_target = metric;
   this->use_bounds = use_bounds;
+  this->conservative = conservative;
+  this->worker = nullptr;
+  this->snapshot_counter = 0;
+  this->publish_pending = false;
+  this->reconfigure_latency_seconds = -1.0;
+  this->reconfigure_latency_packets = -1;
 }
 
 DynamicCountMin::~DynamicCountMin() {
-  delete[] flat_cms;
-  delete[] bobhash;
+  delete[] indexes;
+  delete worker;
 }
 
-void DynamicCountMin::initialize(int width, int start_hash_count, int seed) {
+void DynamicCountMin::use_async_reconfigure() {
+  if (worker == nullptr) {
+    worker = new ReconfigureWorker(optimisation_target, use_bounds);
+  }
+}
+
+void DynamicCountMin::initialize(int width, int start_hash_count, int seed,
+                                 IndexMode index_mode, PageMode page_mode,
+                                 HashFamily hash_family) {
   this->width = width;
   this->hash_count = start_hash_count;
   this->counter = 0;
+  this->index_mode = index_mode;
+  this->index_seed = seed;
 
   width_mask = width - 1;
 
@@ -316,34 +780,92 @@ void DynamicCountMin::initialize(int width, int start_hash_count, int seed) {
   assert(width % 4 == 0 && "We assume that (w % 4 == 0)!");
   assert((width & (width - 1)) == 0 && "We assume that width is a power of 2!");
 
-  flat_cms = new uint32_t[width];
-  bobhash = new BOBHash[start_hash_count];
+  flat_cms = storage.allocate(width, page_mode);
+  uint32_t *seeds = new uint32_t[start_hash_count];
+  indexes = new uint[INCREMENT_BATCH * start_hash_count];
 
   for (int i = 0; i < start_hash_count; ++i) {
-    bobhash[i].initialize((seed * (3 + i) + i + 100) % 1229);
+    seeds[i] = family_seed(flat_seeds, seed, i);
   }
+  hasher.initialize(hash_family, seeds, start_hash_count);
+  delete[] seeds;
 }
 
 void DynamicCountMin::increment(const char *str) {
+  flat_indexes(str, index_mode, index_seed, &hasher, hash_count,
+               width_mask, indexes);
+  increment_indexes(str, indexes);
+}
+
+void DynamicCountMin::increment_batch(const char *packets, size_t n) {
+  for (size_t start = 0; start < n; start += INCREMENT_BATCH) {
+    size_t block = min(n - start, (size_t)INCREMENT_BATCH);
+    const char *block_packets = packets + start * FT_SIZE;
+    // A reconfiguration inside the block only lowers `hash_count`, and the
+    // indexes of a packet do not depend on it, so the indexes computed for the
+    // block stay valid.
+    int stride = hash_count;
+
+    for (size_t j = 0; j < block; ++j) {
+      uint *packet_indexes = indexes + j * stride;
+      flat_indexes(block_packets + j * FT_SIZE, index_mode, index_seed,
+                   &hasher, stride, width_mask, packet_indexes);
+      for (int i = 0; i < stride; ++i) {
+        __builtin_prefetch(&flat_cms[packet_indexes[i]], 1);
+      }
+    }
+
+    for (size_t j = 0; j < block; ++j) {
+      increment_indexes(block_packets + j * FT_SIZE, indexes + j * stride);
+    }
+  }
+}
+
+void DynamicCountMin::increment_indexes(const char *str,
+                                        const uint *indexes) {
   const int threshold = 1 << 17;
   uint32_t min = UINT32_MAX;
-  for (int i = 0; i < hash_count; ++i) {
-    uint index = (bobhash[i].run(str, FT_SIZE)) & width_mask;
-    uint32_t val = ++flat_cms[index];
-    if (val < min) {
-      min = val;
+  if (this->conservative) {
+    min = conservative_update(flat_cms, indexes, hash_count);
+  } else {
+    for (int i = 0; i < hash_count; ++i) {
+      uint32_t val = ++flat_cms[indexes[i]];
+      if (val < min) {
+        min = val;
+      }
     }
   }
   this->counter++;
 
-  if (this->counter == threshold) {
-    this->dynamic_reconfigure();
+  if (this->worker != nullptr) {
+    this->apply_async_decision();
+  }
+
+  if (this->counter == threshold || this->publish_pending) {
+    this->dynamic_reconfigure(true);
+  } else if (this->counter > threshold &&
+             this->skew_estimator == incremental_skew_estimator) {
+    // The incremental estimate is O(1) to read, so rather than only once the
+    // configuration is reconsidered on every packet after the first check.
+    this->dynamic_reconfigure(false);
   }
 
   this->topK->update(str, min);
 }
 
-void DynamicCountMin::dynamic_reconfigure() {
+void DynamicCountMin::dynamic_reconfigure(bool report_unchanged) {
+  if (this->worker != nullptr && report_unchanged) {
+    // Only the first check is handed to the worker, the continuous checks of
+    // the incremental estimator are cheap enough to run inline.
+    publish_pending = !worker->publish(this->topK->descending(), this->counter,
+                                       this->skew_estimator);
+    if (!publish_pending) {
+      snapshot_time = chrono::steady_clock::now();
+      snapshot_counter = this->counter;
+    }
+    return;
+  }
+
   double skew = this->estimate_skew();
 
   int lower = 0;
@@ -362,21 +884,70 @@ void DynamicCountMin::dynamic_reconfigure() {
     new_config = best;
   }
 
+  apply_configuration(new_config, skew, report_unchanged);
+}
+
+void DynamicCountMin::apply_async_decision() {
+  double skew;
+  int new_config = worker->take_decision(&skew);
+  if (new_config == 0) {
+    return;
+  }
+
+  reconfigure_latency_seconds =
+      chrono::duration<double>(chrono::steady_clock::now() - snapshot_time)
+          .count();
+  reconfigure_latency_packets = this->counter - snapshot_counter;
+  printf("Asynchronous reconfiguration decided after %f us (%d packets)\n",
+         reconfigure_latency_seconds * 1e6, reconfigure_latency_packets);
+
+  apply_configuration(new_config, skew, true);
+}
+
+void DynamicCountMin::apply_configuration(int new_config, double skew,
+                                          bool report_unchanged) {
   if (new_config < this->hash_count) {
     printf("Dyanmic reconfigure from %d to %d (skew=%f)\n", this->hash_count,
            new_config, skew);
     this->hash_count = new_config;
-  } else {
+  } else if (report_unchanged) {
     printf("Unable to dyanmic reconfigure from %d to %d (skew=%f)\n",
            this->hash_count, new_config, skew);
   }
 }
 
 uint64_t DynamicCountMin::query(const char *str) {
+  flat_indexes(str, index_mode, index_seed, &hasher, hash_count,
+               width_mask, indexes);
+  return query_indexes(indexes);
+}
+
+uint64_t DynamicCountMin::increment_and_query(const char *str) {
+  flat_indexes(str, index_mode, index_seed, &hasher, hash_count,
+               width_mask, indexes);
+  increment_indexes(str, indexes);
+  return query_indexes(indexes);
+}
+
+uint64_t DynamicCountMin::increment_and_query(const char *str,
+                                              HashCache *cache) {
+  if (index_mode == double_hashing) {
+    return increment_and_query(str);
+  }
+
+  const uint *hashes =
+      cache->get(flat_seeds, index_seed, hasher.get_family(), hash_count);
+  for (int i = 0; i < hash_count; ++i) {
+    indexes[i] = hashes[i] & width_mask;
+  }
+  increment_indexes(str, indexes);
+  return query_indexes(indexes);
+}
+
+uint64_t DynamicCountMin::query_indexes(const uint *indexes) {
   uint64_t min = UINT64_MAX;
   for (int i = 0; i < hash_count; ++i) {
-    uint index = (bobhash[i].run(str, FT_SIZE)) & width_mask;
-    uint64_t temp = flat_cms[index];
+    uint64_t temp = flat_cms[indexes[i]];
     if (min > temp) {
       min = temp;
     }
@@ -385,9 +956,7 @@ uint64_t DynamicCountMin::query(const char *str) {
 }
 
 double DynamicCountMin::estimate_skew() {
-  auto items = this->topK->items();
-  return small_set_estimate_skew(this->counter, items.size(), items.begin(),
-                                 items.end());
+  return estimate_topk_skew(this->skew_estimator, this->counter, *this->topK);
 }
 
 double DynamicCountMin::sketch_error(double alpha, long total, int mem) {
@@ -16,22 +16,104 @@
 #include <random>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string>
 #include <time.h>
 
 #include "BobHash.hpp"
 #include "Defs.hpp"
+#include "counter_storage.hpp"
+#include "hash_family.hpp"
+#include "heavy_hitters.hpp"
 #include "optimal_parameters.hpp"
-#include "topK.hpp"
+#include "reconfigure_worker.hpp"
+#include "skew_estimation.hpp"
 
 using namespace std;
 
+/// How the flat sketches turn a packet into `hash_count` counter indexes.
+enum IndexMode {
+  // One BobHash run per hash function, each with its own seed.
+  per_row_hash = 0,
+  // Kirsch-Mitzenmacher double hashing: a single 64 bit XXH3 hash is split
+  // into h1 and h2 and the i-th index is h1 + i * h2.
+  double_hashing = 1,
+};
+
+std::string index_mode_name(IndexMode mode);
+
+/// The seeds a sketch derives its hash functions from. For a given seed the
+/// i-th hash function is the same in every sketch of a family, whatever their
+/// hash counts, which lets a HashCache share the hashes of a packet.
+enum SeedFamily {
+  // CountMinFlat, CountMinBlocked and DynamicCountMin.
+  flat_seeds = 0,
+  // The row based sketches.
+  row_seeds = 1,
+};
+
+const int SEED_FAMILY_COUNT = 2;
+
+// The seed of the i-th hash function of a sketch seeded with `seed`.
+uint32_t family_seed(SeedFamily family, int seed, int i);
+
+/// Hashes a packet once for every sketch of an experiment. After `set_packet`
+/// the first sketch of each seed family to ask computes `max_hash_count`
+/// hashes, the others reuse them.
+class HashCache {
+  int seed;
+  int max_hash_count;
+  HashFamily hash_family;
+
+  PacketHasher hashers[SEED_FAMILY_COUNT];
+  uint *hashes;
+  bool computed[SEED_FAMILY_COUNT];
+  const char *packet;
+
+public:
+  HashCache();
+  ~HashCache();
+
+  void initialize(int seed, int max_hash_count, HashFamily hash_family);
+  // `str` must stay valid until the next call.
+  void set_packet(const char *str);
+  // The raw hashes of the current packet, the sketch's configuration is only
+  // passed to check that it matches the cache.
+  const uint *get(SeedFamily family, int seed, HashFamily hash_family,
+                  int hash_count);
+};
+
+// The number of packets `increment_batch` hashes (and prefetches the counters
+// of) before incrementing any of them.
+const size_t INCREMENT_BATCH = 16;
+
+// The number of counters in one 64 byte cache line.
+const int BLOCK_COUNTERS = 64 / sizeof(uint32_t);
+
 class EvaluatableSketch {
 public:
+  virtual ~EvaluatableSketch() {}
+
   virtual void increment(const char *str) = 0;
+  // Increments `n` packets stored back to back (FT_SIZE bytes each).
+  virtual void increment_batch(const char *packets, size_t n) = 0;
   virtual uint64_t query(const char *str) = 0;
+  // Same as `increment` followed by `query` but the packet is only hashed once.
+  virtual uint64_t increment_and_query(const char *str) = 0;
+  // Same as above with the hashes of `str` taken from `cache`, which must have
+  // been initialized with the same seed and hash family as the sketch.
+  virtual uint64_t increment_and_query(const char *str, HashCache *cache) = 0;
   virtual double estimate_skew() = 0;
   virtual double sketch_error(double alpha, long total, int mem) = 0;
   virtual int get_hash_function_count() = 0;
+
+  // Selects the estimator `estimate_skew` (and the dynamic reconfiguration)
+  // uses, the grid search by default.
+  void set_skew_estimator(SkewEstimator estimator) {
+    this->skew_estimator = estimator;
+  }
+
+protected:
+  SkewEstimator skew_estimator = grid_skew_estimator;
 };
 
 class CountMinBaseline {
@@ -41,7 +123,11 @@ class CountMinBaseline {
 
   int width_mask;
 
-  BOBHash *bobhash;
+  PacketHasher hasher;
+  uint *hashes;
+
+  CounterStorage storage;
+  uint32_t *counters;
 
 public:
   uint32_t **baseline_cms;
@@ -49,8 +135,11 @@ public:
   CountMinBaseline();
   ~CountMinBaseline();
 
-  void initialize(int width, int height, int seed);
+  void initialize(int width, int height, int seed,
+                  PageMode page_mode = default_pages,
+                  HashFamily hash_family = bob_hash);
   void increment(const char *str);
+  void increment_batch(const char *packets, size_t n);
   uint64_t query(const char *str);
 
   void print_indexes(const char *str);
@@ -61,7 +150,11 @@ public:
 class CountMinBaselineFlexibleWidth {
   int width;
 
-  BOBHash *bobhash;
+  PacketHasher hasher;
+  uint *hashes;
+
+  CounterStorage storage;
+  uint32_t *counters;
 
 public:
   int height;
@@ -70,8 +163,11 @@ public:
   CountMinBaselineFlexibleWidth();
   ~CountMinBaselineFlexibleWidth();
 
-  void initialize(int width, int height, int seed);
+  void initialize(int width, int height, int seed,
+                  PageMode page_mode = default_pages,
+                  HashFamily hash_family = bob_hash);
   void increment(const char *str);
+  void increment_batch(const char *packets, size_t n);
   uint64_t query(const char *str);
 };
 
@@ -79,23 +175,41 @@ class CountMinFlat : public EvaluatableSketch {
 
   int width;
   int counter;
+  bool conservative;
 
   int width_mask;
 
-  BOBHash *bobhash;
+  IndexMode index_mode;
+  uint64_t index_seed;
+  PacketHasher hasher;
+  uint *indexes;
 
+  CounterStorage storage;
   uint32_t *flat_cms;
 
+  void increment_indexes(const char *str, const uint *indexes);
+  uint64_t query_indexes(const uint *indexes);
+
+protected:
+  // Set `conservative` to update the counters like CountMinConservative.
+  CountMinFlat(int k, HeavyHitterMode heavy_hitters, bool conservative);
+
 public:
   int hash_count;
-  TopK *topK;
+  HeavyHitters *topK;
 
-  CountMinFlat(int k);
+  CountMinFlat(int k, HeavyHitterMode heavy_hitters = top_k_heap);
   ~CountMinFlat();
 
-  void initialize(int width, int hash_count, int seed);
+  void initialize(int width, int hash_count, int seed,
+                  IndexMode index_mode = per_row_hash,
+                  PageMode page_mode = default_pages,
+                  HashFamily hash_family = bob_hash);
   void increment(const char *str);
+  void increment_batch(const char *packets, size_t n);
   uint64_t query(const char *str);
+  uint64_t increment_and_query(const char *str);
+  uint64_t increment_and_query(const char *str, HashCache *cache);
 
   double estimate_skew();
   double sketch_error(double alpha, long total, int mem);
@@ -106,21 +220,35 @@ class CountMinTopK : public EvaluatableSketch {
 
   int width;
 
-  BOBHash *bobhash;
+  PacketHasher hasher;
+  uint *hashes;
+
+  CounterStorage storage;
+  uint32_t *counters;
   int counter;
+  int seed;
+
+  void row_indexes(const char *str, uint *indexes);
+  void increment_indexes(const char *str, const uint *indexes);
+  uint64_t query_indexes(const uint *indexes);
 
 public:
   int height;
-  TopK *topK;
+  HeavyHitters *topK;
   uint32_t **baseline_cms;
 
   // We keep track of the k top elements.
-  CountMinTopK(int k);
+  CountMinTopK(int k, HeavyHitterMode heavy_hitters = top_k_heap);
   ~CountMinTopK();
 
-  void initialize(int width, int height, int seed);
+  void initialize(int width, int height, int seed,
+                  PageMode page_mode = default_pages,
+                  HashFamily hash_family = bob_hash);
   void increment(const char *str);
+  void increment_batch(const char *packets, size_t n);
   uint64_t query(const char *str);
+  uint64_t increment_and_query(const char *str);
+  uint64_t increment_and_query(const char *str, HashCache *cache);
 
   void print_indexes(const char *str);
   double estimate_skew();
@@ -128,36 +256,128 @@ public:
   int get_hash_function_count();
 };
 
+/// A flat sketch where all the counters of a packet lie in one 64 byte cache
+/// line. The first hash picks the block (and its own counter within it), the
+/// other hashes only pick a counter within that block, so an update costs a
+/// single cache miss regardless of the number of hash functions.
+class CountMinBlocked : public EvaluatableSketch {
+
+  int width;
+  int counter;
+
+  int block_mask;
+
+  PacketHasher hasher;
+  uint *indexes;
+
+  CounterStorage storage;
+  uint32_t *flat_cms;
+
+  int seed;
+
+  void blocked_indexes(const char *str, uint *indexes);
+  void block_offsets(const uint *hashes, uint *indexes);
+  void increment_indexes(const char *str, const uint *indexes);
+  uint64_t query_indexes(const uint *indexes);
+
+public:
+  int hash_count;
+  HeavyHitters *topK;
+
+  CountMinBlocked(int k, HeavyHitterMode heavy_hitters = top_k_heap);
+  ~CountMinBlocked();
+
+  void initialize(int width, int hash_count, int seed,
+                  PageMode page_mode = default_pages,
+                  HashFamily hash_family = bob_hash);
+  void increment(const char *str);
+  void increment_batch(const char *packets, size_t n);
+  uint64_t query(const char *str);
+  uint64_t increment_and_query(const char *str);
+  uint64_t increment_and_query(const char *str, HashCache *cache);
+
+  double estimate_skew();
+  double sketch_error(double alpha, long total, int mem);
+  int get_hash_function_count();
+};
+
+/// A flat sketch with conservative update: a packet only raises the counters
+/// below its new estimate (its minimum + 1) instead of incrementing all of
+/// them, which lowers the overestimation for the same memory.
+class CountMinConservative : public CountMinFlat {
+public:
+  CountMinConservative(int k, HeavyHitterMode heavy_hitters = top_k_heap);
+};
+
 class DynamicCountMin : public EvaluatableSketch {
   int width;
   int counter;
   bool use_bounds;
+  bool conservative;
 
   int width_mask;
 
-  BOBHash *bobhash;
+  IndexMode index_mode;
+  uint64_t index_seed;
+  PacketHasher hasher;
+  uint *indexes;
 
+  CounterStorage storage;
   uint32_t *flat_cms;
 
   ErrorMetric optimisation_target;
 
-  void dynamic_reconfigure();
+  // Set by `use_async_reconfigure`, with the time and packet the snapshot was
+  // published at.
+  ReconfigureWorker *worker;
+  chrono::steady_clock::time_point snapshot_time;
+  int snapshot_counter;
+  // Set while the first check could not be published (the worker was busy),
+  // it is retried on every update until it is.
+  bool publish_pending;
+
+  // Lowers `hash_count` if the estimated skew calls for fewer hash functions,
+  // `report_unchanged` also prints when it does not.
+  void dynamic_reconfigure(bool report_unchanged);
+  void apply_configuration(int new_config, double skew, bool report_unchanged);
+  void apply_async_decision();
+  void increment_indexes(const char *str, const uint *indexes);
+  uint64_t query_indexes(const uint *indexes);
 
 public:
   int hash_count;
-  TopK *topK;
+  HeavyHitters *topK;
 
   // set `use_bounds` to use the error bounds, otherwise it uses the lowest
-  // average error configuration.
-  DynamicCountMin(int k, ErrorMetric optimisation_target, bool use_bounds);
+  // average error configuration. Set `conservative` to update the counters
+  // like CountMinConservative.
+  DynamicCountMin(int k, ErrorMetric optimisation_target, bool use_bounds,
+                  bool conservative = false,
+                  HeavyHitterMode heavy_hitters = top_k_heap);
   ~DynamicCountMin();
 
-  void initialize(int width, int hash_count, int seed);
+  void initialize(int width, int hash_count, int seed,
+                  IndexMode index_mode = per_row_hash,
+                  PageMode page_mode = default_pages,
+                  HashFamily hash_family = bob_hash);
   void increment(const char *str);
+  void increment_batch(const char *packets, size_t n);
   uint64_t query(const char *str);
+  uint64_t increment_and_query(const char *str);
+  uint64_t increment_and_query(const char *str, HashCache *cache);
 
   double estimate_skew();
   double sketch_error(double alpha, long total, int mem);
   int get_hash_function_count();
+
+  // Makes the reconfiguration asynchronous: the top-k is published to a
+  // background thread which decides the hash count, applied on a later
+  // update.
+  void use_async_reconfigure();
+
+  // With asynchronous reconfiguration, the time and the number of packets
+  // between publishing the snapshot and applying the decision (-1 until then).
+  double reconfigure_latency_seconds;
+  int reconfigure_latency_packets;
 };
 #endif
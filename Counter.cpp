@@ -45,6 +45,8 @@ HashPacketCounter::HashPacketCounter(int length) {}
 
 HashPacketCounter::~HashPacketCounter() {}
 
+void HashPacketCounter::reserve(size_t keys) { this->map.reserve(keys); }
+
 int HashPacketCounter::increment(char *str) {
   std::array<char, FT_SIZE> flow_id;
   memcpy(&flow_id, str, FT_SIZE);
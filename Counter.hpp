@@ -36,6 +36,9 @@ public:
   int query(char *str);
   int query_index(int index);
 
+  // Makes room for `keys` distinct packets up front.
+  void reserve(size_t keys);
+
   void reset();
 
 private:
@@ -1,5 +1,17 @@
 #include "TraceReader.hpp"
 #include "Defs.hpp"
+#include "compact_trace.hpp"
+#include "indexed_trace.hpp"
+#include "prefetching_reader.hpp"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 ZipfReader::ZipfReader(char *path) {
   this->ifs = std::ifstream(path);
@@ -21,3 +33,160 @@ ZipfReader::~ZipfReader() { this->buffer->close(); }
 int ZipfReader::read_next_packet(char *dest) {
   return this->buffer->sgetn(dest, FT_SIZE);
 }
+
+size_t ZipfReader::read_packets(char *dest, size_t max) {
+  return this->buffer->sgetn(dest, max * FT_SIZE) / FT_SIZE;
+}
+
+MappedTraceReader::MappedTraceReader(const char *path, bool populate) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    std::string msg = "Failed to open zipf file for reading --";
+    msg += path;
+    msg += "--";
+    throw std::runtime_error(msg);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error(std::string("Failed to stat ") + path);
+  }
+
+  this->mapping = nullptr;
+  this->mapping_size = st.st_size;
+  this->first = nullptr;
+  this->count = 0;
+  this->next = 0;
+
+  if (mapping_size > 0) {
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (populate) {
+      flags |= MAP_POPULATE;
+    }
+#else
+    (void)populate;
+#endif
+    mapping = mmap(nullptr, mapping_size, PROT_READ, flags, fd, 0);
+    if (mapping == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error(std::string("Failed to map ") + path);
+    }
+    madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+
+    // Like ZipfReader the first record is skipped, and a partial record at
+    // the end is not a packet.
+    if (mapping_size >= FT_SIZE) {
+      first = (const char *)mapping + FT_SIZE;
+      count = (mapping_size - FT_SIZE) / FT_SIZE;
+    }
+  }
+  close(fd);
+}
+
+MappedTraceReader::~MappedTraceReader() {
+  if (mapping != nullptr) {
+    munmap(mapping, mapping_size);
+  }
+}
+
+size_t MappedTraceReader::next_chunk(const char **chunk, size_t max_packets) {
+  size_t n = std::min(max_packets, count - next);
+  *chunk = first + next * FT_SIZE;
+  next += n;
+  return n;
+}
+
+size_t MappedTraceReader::read_packets(char *dest, size_t max) {
+  const char *chunk;
+  size_t n = next_chunk(&chunk, max);
+  memcpy(dest, chunk, n * FT_SIZE);
+  return n;
+}
+
+int MappedTraceReader::read_next_packet(char *dest) {
+  if (next == count) {
+    return 0;
+  }
+  memcpy(dest, first + next * FT_SIZE, FT_SIZE);
+  next++;
+  return FT_SIZE;
+}
+
+bool trace_has_magic(const char *path, const char *magic) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return false;
+  }
+  char start[4];
+  bool matches = fread(start, 1, 4, f) == 4 && memcmp(start, magic, 4) == 0;
+  fclose(f);
+  return matches;
+}
+
+std::string trace_reader_mode_name(TraceReaderMode mode) {
+  switch (mode) {
+  case stream_trace_reader:
+    return "stream";
+  case prefetch_trace_reader:
+    return "prefetch";
+  case direct_trace_reader:
+    return "direct";
+  case mmap_trace_reader:
+    return "mmap";
+  }
+  throw std::runtime_error("invalid trace reader mode");
+}
+
+TraceReaderMode parse_trace_reader_mode(const char *name) {
+  for (int i = 0; i < TRACE_READER_MODE_COUNT; i++) {
+    if (trace_reader_mode_name((TraceReaderMode)i) == name) {
+      return (TraceReaderMode)i;
+    }
+  }
+  throw std::runtime_error(std::string("Unknown trace reader ") + name);
+}
+
+PacketReader *open_trace_reader(char *path, TraceReaderMode mode) {
+  // Compact and indexed traces are recognised by their magic whatever the
+  // mode.
+  if (trace_has_magic(path, COMPACT_TRACE_MAGIC)) {
+    return new CompactTraceReader(path);
+  }
+  if (trace_has_magic(path, INDEXED_TRACE_MAGIC)) {
+    return new IndexedTraceReader(TraceIndex(path));
+  }
+
+  switch (mode) {
+  case stream_trace_reader:
+    return new ZipfReader(path);
+  case prefetch_trace_reader:
+    return new PrefetchingTraceReader(path);
+  case direct_trace_reader:
+    return new PrefetchingTraceReader(path, true);
+  case mmap_trace_reader:
+    return new MappedTraceReader(path);
+  }
+  throw std::runtime_error("invalid trace reader mode");
+}
+
+TracePackets::TracePackets(PacketReader *reader, size_t chunk_packets) {
+  this->reader = reader;
+  this->chunk_packets = chunk_packets;
+  if (!reader->reads_in_place()) {
+    this->buffer.resize(chunk_packets * FT_SIZE);
+  }
+  this->chunk = nullptr;
+  this->count = 0;
+}
+
+bool TracePackets::refill() {
+  if (reader->reads_in_place()) {
+    count = reader->next_chunk(&chunk, chunk_packets);
+  } else {
+    count = reader->read_packets(buffer.data(), chunk_packets);
+    chunk = buffer.data();
+  }
+  return count > 0;
+}
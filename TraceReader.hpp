@@ -1,17 +1,154 @@
 #pragma once
 
+#include "Defs.hpp"
 #include <fstream>
 #include <iostream>
+#include <stddef.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
-class ZipfReader {
+/// A source of FT_SIZE byte packets.
+class PacketReader {
+public:
+  virtual ~PacketReader() {}
+
+  // `dest` must be at least FT_SIZE bytes long. Returns the number of bytes
+  // read, FT_SIZE unless the trace has ended.
+  virtual int read_next_packet(char *dest) = 0;
+  // Reads up to `max` packets back to back into `dest` (which must hold `max`
+  // * FT_SIZE bytes), returns how many. Fewer than `max` means the trace has
+  // ended, a partial packet at its end is dropped.
+  virtual size_t read_packets(char *dest, size_t max) = 0;
+
+  // Whether the reader holds the packets in memory and hands them out in place
+  // with `next_chunk`.
+  virtual bool reads_in_place() { return false; }
+  // Points `chunk` at the next (at most) `max_packets` packets and returns how
+  // many there are, 0 once all have been read. Only for readers that
+  // `reads_in_place`.
+  virtual size_t next_chunk(const char **, size_t) {
+    throw std::runtime_error("The trace reader cannot read in place");
+  }
+};
+
+class ZipfReader : public PacketReader {
 public:
   ZipfReader(char *path);
   ~ZipfReader();
 
   // `dest` must be at least FT_SIZE bytes long.
   int read_next_packet(char *dest);
+  size_t read_packets(char *dest, size_t max);
 
 private:
   std::filebuf *buffer;
   std::ifstream ifs;
 };
+
+/// Reads the same traces as ZipfReader by mapping them into memory, so the
+/// packets can be used in place as one array of FT_SIZE byte records rather
+/// than copied out one at a time.
+class MappedTraceReader : public PacketReader {
+public:
+  // `populate` pre-faults the whole mapping (MAP_POPULATE, where available)
+  // rather than on first access.
+  MappedTraceReader(const char *path, bool populate = false);
+  ~MappedTraceReader();
+
+  // All the packets, back to back. Valid for the reader's lifetime.
+  const char *packets() { return first; }
+  size_t packet_count() { return count; }
+
+  bool reads_in_place() { return true; }
+  size_t next_chunk(const char **chunk, size_t max_packets);
+
+  // Copies the next packet like ZipfReader::read_next_packet, returns FT_SIZE
+  // or 0 once all have been read.
+  int read_next_packet(char *dest);
+  size_t read_packets(char *dest, size_t max);
+
+private:
+  void *mapping;
+  size_t mapping_size;
+
+  const char *first;
+  size_t count;
+  size_t next;
+};
+
+/// How the experiments read their traces, selected with
+/// `--trace_reader=<name>`.
+enum TraceReaderMode {
+  // `ZipfReader`, reading on demand on the experiment's thread.
+  stream_trace_reader = 0,
+  // `PrefetchingTraceReader`, reading ahead on an I/O thread.
+  prefetch_trace_reader = 1,
+  // `PrefetchingTraceReader` with O_DIRECT.
+  direct_trace_reader = 2,
+  // `MappedTraceReader`, the experiments use the packets in place.
+  mmap_trace_reader = 3,
+};
+
+const int TRACE_READER_MODE_COUNT = 4;
+
+std::string trace_reader_mode_name(TraceReaderMode mode);
+// Parses the short names accepted on the command line (stream, prefetch,
+// direct, mmap).
+TraceReaderMode parse_trace_reader_mode(const char *name);
+
+// Whether the file at `path` starts with the 4 byte `magic`.
+bool trace_has_magic(const char *path, const char *magic);
+
+// Opens a compact trace (see compact_trace.hpp) with CompactTraceReader, an
+// indexed trace (see indexed_trace.hpp) with IndexedTraceReader, otherwise a
+// raw trace with the reader `mode` selects.
+PacketReader *open_trace_reader(char *path, TraceReaderMode mode);
+
+/// Iterates over the packets of a reader, which it reads `chunk_packets` at a
+/// time:
+///
+///   for (char *packet : TracePackets(reader)) { ... }
+///
+/// Each packet is valid until the iteration moves past it, and must not be
+/// written to: readers that `reads_in_place` hand out their own memory.
+class TracePackets {
+  PacketReader *reader;
+  size_t chunk_packets;
+  std::vector<char> buffer;
+  // The current chunk, in `buffer` or the reader's memory.
+  const char *chunk;
+  size_t count;
+
+  // Reads (or points `chunk` at) the next chunk, returns false at the end.
+  bool refill();
+
+public:
+  class iterator {
+    TracePackets *packets;
+    size_t index;
+
+  public:
+    iterator(TracePackets *packets, size_t index)
+        : packets(packets), index(index) {}
+
+    char *operator*() { return (char *)packets->chunk + index * FT_SIZE; }
+    iterator &operator++() {
+      if (++index == packets->count) {
+        index = 0;
+        if (!packets->refill()) {
+          packets = nullptr;
+        }
+      }
+      return *this;
+    }
+    bool operator!=(const iterator &other) const {
+      return packets != other.packets || index != other.index;
+    }
+  };
+
+  TracePackets(PacketReader *reader, size_t chunk_packets = 4096);
+
+  iterator begin() { return iterator(refill() ? this : nullptr, 0); }
+  iterator end() { return iterator(nullptr, 0); }
+};
@@ -0,0 +1,175 @@
+#include "compact_trace.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+// The id of a packet in the `genzipf` layout, or false if it is not one.
+static bool zipf_packet_id(const char *packet, uint32_t *id) {
+  memcpy(id, packet, 4);
+  return memcmp(packet + 4, packet, 4) == 0 &&
+         memcmp(packet + 8, packet, 4) == 0 && (uint8_t)packet[12] == 0xFF;
+}
+
+static void write_varint(std::vector<uint8_t> *out, uint32_t value) {
+  while (value >= 0x80) {
+    out->push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back((uint8_t)value);
+}
+
+CompactTraceReader::CompactTraceReader(const char *path) {
+  if (file.open(path, std::ios::in | std::ios::binary) == nullptr) {
+    std::string msg = "Failed to open compact trace for reading --";
+    msg += path;
+    msg += "--";
+    throw std::runtime_error(msg);
+  }
+
+  if (file.sgetn((char *)&header, sizeof(header)) != sizeof(header) ||
+      memcmp(header.magic, COMPACT_TRACE_MAGIC, 4) != 0) {
+    throw std::runtime_error(std::string("Not a compact trace: ") + path);
+  }
+  if (header.version != COMPACT_TRACE_VERSION) {
+    throw std::runtime_error("Unsupported compact trace version " +
+                             std::to_string(header.version));
+  }
+  if (header.key_layout != zipf_key_layout) {
+    throw std::runtime_error("Unsupported compact trace key layout " +
+                             std::to_string(header.key_layout));
+  }
+
+  position = 0;
+  block_remaining = 0;
+}
+
+CompactTraceReader::~CompactTraceReader() { file.close(); }
+
+bool CompactTraceReader::next_block() {
+  uint32_t sizes[2];
+  std::streamsize n = file.sgetn((char *)sizes, sizeof(sizes));
+  if (n == 0) {
+    return false;
+  }
+  if (n != sizeof(sizes) || sizes[0] > header.block_packets ||
+      sizes[1] > 5 * sizes[0]) {
+    throw std::runtime_error("Corrupt compact trace block header");
+  }
+
+  // A varint is at most 5 bytes, so decoding the block reads at most 5 bytes a
+  // packet even if it is corrupt, see `read_packets`.
+  block_size = sizes[1];
+  block.resize(5 * (size_t)sizes[0]);
+  if (file.sgetn((char *)block.data(), block_size) !=
+      (std::streamsize)block_size) {
+    throw std::runtime_error("Truncated compact trace block");
+  }
+  position = 0;
+  block_remaining = sizes[0];
+  return true;
+}
+
+size_t CompactTraceReader::read_packets(char *dest, size_t max) {
+  size_t n = 0;
+  while (n < max) {
+    if (block_remaining == 0 && !next_block()) {
+      break;
+    }
+
+    // `block` is padded so varints running past the block's end (in a corrupt
+    // trace) are caught once the packets are decoded, not per byte.
+    size_t count = std::min((size_t)block_remaining, max - n);
+    const uint8_t *in = block.data() + position;
+    for (size_t i = 0; i < count; i++) {
+      uint32_t id = *in++;
+      if (id >= 0x80) {
+        id &= 0x7F;
+        for (int shift = 7; shift <= 28; shift += 7) {
+          uint8_t byte = *in++;
+          id |= (uint32_t)(byte & 0x7F) << shift;
+          if (byte < 0x80) {
+            break;
+          }
+        }
+      }
+
+      char *packet = dest + (n + i) * FT_SIZE;
+      memcpy(packet, &id, 4);
+      memcpy(packet + 4, &id, 4);
+      memcpy(packet + 8, &id, 4);
+      packet[12] = (char)0xFF;
+    }
+
+    position = in - block.data();
+    if (position > block_size) {
+      throw std::runtime_error("Corrupt compact trace block");
+    }
+    block_remaining -= count;
+    n += count;
+  }
+  return n;
+}
+
+int CompactTraceReader::read_next_packet(char *dest) {
+  return read_packets(dest, 1) * FT_SIZE;
+}
+
+uint64_t convert_to_compact_trace(char *raw_path, const char *compact_path,
+                                  uint32_t block_packets) {
+  FILE *out = fopen(compact_path, "wb");
+  if (out == NULL) {
+    throw std::runtime_error(std::string("Failed to open ") + compact_path);
+  }
+
+  CompactTraceHeader header;
+  memcpy(header.magic, COMPACT_TRACE_MAGIC, 4);
+  header.version = COMPACT_TRACE_VERSION;
+  header.key_layout = zipf_key_layout;
+  header.block_packets = block_packets;
+  header.packet_count = 0;
+  // Rewritten with the packet count at the end.
+  fwrite(&header, sizeof(header), 1, out);
+
+  std::vector<uint8_t> block;
+  block.reserve((size_t)block_packets * 5);
+  uint32_t block_count = 0;
+
+  auto flush_block = [&]() {
+    uint32_t sizes[2] = {block_count, (uint32_t)block.size()};
+    fwrite(sizes, sizeof(sizes), 1, out);
+    fwrite(block.data(), 1, block.size(), out);
+    block.clear();
+    block_count = 0;
+  };
+
+  ZipfReader *reader = new ZipfReader(raw_path);
+  for (char *packet : TracePackets(reader)) {
+    uint32_t id;
+    if (!zipf_packet_id(packet, &id)) {
+      delete reader;
+      fclose(out);
+      throw std::runtime_error("Packet " +
+                               std::to_string(header.packet_count) +
+                               " is not a synthetic zipf packet");
+    }
+    write_varint(&block, id);
+    header.packet_count++;
+    if (++block_count == block_packets) {
+      flush_block();
+    }
+  }
+  delete reader;
+  if (block_count > 0) {
+    flush_block();
+  }
+
+  fseek(out, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, out);
+  if (ferror(out) || fclose(out) != 0) {
+    throw std::runtime_error(std::string("Failed to write ") + compact_path);
+  }
+  return header.packet_count;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "TraceReader.hpp"
+
+/// A compact encoding of the synthetic traces written by `genzipf`, whose
+/// packets are a 4 byte id repeated three times and a 0xFF flag, so a packet
+/// only carries the id.
+///
+/// The file starts with a `CompactTraceHeader`, followed by blocks of up to
+/// `block_packets` packets. Each block is a uint32 packet count and a uint32
+/// byte length, then the ids as LEB128 varints (Zipf ranks are mostly small,
+/// so most take one or two bytes). All integers are little endian.
+///
+/// Unlike the raw traces there is no leading record to skip: the trace holds
+/// exactly the packets ZipfReader yields for the raw trace it was made from.
+struct CompactTraceHeader {
+  char magic[4];
+  uint32_t version;
+  // How the 13 byte packet is rebuilt from an id, `zipf_key_layout`.
+  uint32_t key_layout;
+  uint32_t block_packets;
+  uint64_t packet_count;
+};
+
+static_assert(sizeof(CompactTraceHeader) == 24,
+              "CompactTraceHeader is written as is");
+
+const char COMPACT_TRACE_MAGIC[4] = {'Z', 'T', 'R', 'C'};
+const uint32_t COMPACT_TRACE_VERSION = 1;
+// The id three times then 0xFF, as written by `genzipf`.
+const uint32_t zipf_key_layout = 1;
+
+/// Decodes a compact trace block by block, rebuilding the 13 byte packets.
+class CompactTraceReader : public PacketReader {
+public:
+  CompactTraceReader(const char *path);
+  ~CompactTraceReader();
+
+  int read_next_packet(char *dest);
+  size_t read_packets(char *dest, size_t max);
+
+  uint64_t packet_count() const { return header.packet_count; }
+
+private:
+  std::filebuf file;
+  CompactTraceHeader header;
+
+  // The varints of the current block and how many packets are left in it.
+  std::vector<uint8_t> block;
+  size_t block_size;
+  size_t position;
+  uint32_t block_remaining;
+
+  // Reads the next block, returns false at the end of the trace.
+  bool next_block();
+};
+
+// Converts the raw trace at `raw_path` to a compact trace, returns the number
+// of packets. Throws if a packet does not have the `genzipf` layout.
+uint64_t convert_to_compact_trace(char *raw_path, const char *compact_path,
+                                  uint32_t block_packets = 1 << 16);
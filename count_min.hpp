@@ -0,0 +1,313 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "BobHash.hpp"
+#include "CMS.hpp"
+#include "counter_storage.hpp"
+#include "skew_estimation.hpp"
+
+/*
+ * Count-min sketches specialised at compile time.
+ *
+ * The sketches in CMS.hpp take their width and hash count at runtime, so every
+ * row loop has a runtime bound and every index needs a runtime mask or modulo.
+ * `CountMin` fixes the number of hash functions (and optionally the width) as
+ * template parameters so the row loops unroll and indexing is a constant mask.
+ *
+ * The layouts mirror the existing sketches (same seeds, same indexes):
+ *  - `FlatLayout` is CountMinFlat, all hashes index one array of `width`.
+ *  - `RowLayout` is CountMinTopK, hash i indexes its own row of `width`.
+ */
+
+// Passed as `LogWidth` when the width is only known at runtime.
+const int runtime_width = -1;
+
+// `LogWidth` as a shift count. The compile time width paths are instantiated
+// for `runtime_width` too (but not taken), where this is 0.
+constexpr int log_width_shift(int log_width) {
+  return log_width < 0 ? 0 : log_width;
+}
+
+/// All hash functions index a single shared array of `width` counters, which
+/// must be a power of 2. When `LogWidth` is given the width is 2^LogWidth.
+template <int LogWidth = runtime_width> struct FlatLayout {
+  static const SeedFamily seed_family = flat_seeds;
+
+  static size_t counter_count(int width, int) {
+    assert((width & (width - 1)) == 0 &&
+           "We assume that width is a power of 2!");
+    assert((LogWidth == runtime_width ||
+            width == 1 << log_width_shift(LogWidth)) &&
+           "The width does not match LogWidth");
+    return width;
+  }
+
+  static uint32_t index(uint32_t hash, int, int width) {
+    if (LogWidth != runtime_width) {
+      return hash & ((1u << log_width_shift(LogWidth)) - 1);
+    }
+    return hash & (width - 1);
+  }
+
+  // The fraction of counters above `threshold`.
+  template <typename CounterT>
+  static double failure_probability(const CounterT *counters, int width, int,
+                                    uint32_t threshold) {
+    int above_threshold = 0;
+    for (int counter = 0; counter < width; counter++) {
+      if (counters[counter] > threshold) {
+        above_threshold++;
+      }
+    }
+    return (double)above_threshold / (double)width;
+  }
+};
+
+/// Each hash function has its own row of `width` counters. Without `LogWidth`
+/// the width can be anything (indexing uses a modulo, like CountMinTopK).
+template <int LogWidth = runtime_width> struct RowLayout {
+  static const SeedFamily seed_family = row_seeds;
+
+  static size_t counter_count(int width, int depth) {
+    assert((LogWidth == runtime_width ||
+            width == 1 << log_width_shift(LogWidth)) &&
+           "The width does not match LogWidth");
+    return (size_t)width * depth;
+  }
+
+  static uint32_t index(uint32_t hash, int i, int width) {
+    if (LogWidth != runtime_width) {
+      const int shift = log_width_shift(LogWidth);
+      return ((uint32_t)i << shift) + (hash & ((1u << shift) - 1));
+    }
+    return i * width + hash % width;
+  }
+
+  // The product over the rows of the fraction of counters above `threshold`.
+  template <typename CounterT>
+  static double failure_probability(const CounterT *counters, int width,
+                                    int depth, uint32_t threshold) {
+    long double failure_prob = 1.0;
+    for (int row = 0; row < depth; row++) {
+      int above_threshold = 0;
+      for (int counter = 0; counter < width; counter++) {
+        if (counters[(size_t)row * width + counter] > threshold) {
+          above_threshold++;
+        }
+      }
+      failure_prob *= (long double)above_threshold / (long double)width;
+    }
+    return failure_prob;
+  }
+};
+
+/// Hashes a packet with one BobHash per hash function (the same hashes as the
+/// sketches in CMS.hpp), all computed in a single multi-seed run.
+class BobHashPolicy {
+  BOBHash *bobhash;
+  BOBHashMulti multi_hash;
+
+public:
+  static const HashFamily family = bob_hash;
+
+  BobHashPolicy() { bobhash = nullptr; }
+  ~BobHashPolicy() { delete[] bobhash; }
+
+  void initialize(const uint32_t *seeds, int count) {
+    delete[] bobhash;
+    bobhash = new BOBHash[count];
+    for (int i = 0; i < count; ++i) {
+      bobhash[i].initialize(seeds[i]);
+    }
+    multi_hash.initialize(bobhash, count);
+  }
+
+  void hash(const char *str, uint32_t *out, int count) {
+    multi_hash.run(str, FT_SIZE, out, count);
+  }
+};
+
+template <typename Layout, int Depth, typename Hash = BobHashPolicy,
+          typename CounterT = uint32_t>
+class CountMin : public EvaluatableSketch {
+  static_assert(Depth > 0, "A count-min sketch needs at least one hash");
+
+  int width;
+  int counter;
+  int seed;
+
+  Hash hash;
+  uint32_t indexes[INCREMENT_BATCH * Depth];
+
+  CounterStorage storage;
+  CounterT *counters;
+
+  void packet_indexes(const char *str, uint32_t *indexes) {
+    hash.hash(str, indexes, Depth);
+    for (int i = 0; i < Depth; ++i) {
+      indexes[i] = Layout::index(indexes[i], i, width);
+    }
+  }
+
+  void increment_indexes(const char *str, const uint32_t *indexes) {
+    CounterT min = ++counters[indexes[0]];
+    for (int i = 1; i < Depth; ++i) {
+      CounterT val = ++counters[indexes[i]];
+      if (val < min) {
+        min = val;
+      }
+    }
+    this->counter++;
+    this->topK->update(str, min);
+  }
+
+  uint64_t query_indexes(const uint32_t *indexes) {
+    uint64_t min = counters[indexes[0]];
+    for (int i = 1; i < Depth; ++i) {
+      uint64_t temp = counters[indexes[i]];
+      if (temp < min) {
+        min = temp;
+      }
+    }
+    return min;
+  }
+
+public:
+  HeavyHitters *topK;
+
+  CountMin(int k, HeavyHitterMode heavy_hitters = top_k_heap) {
+    this->topK = make_heavy_hitters(heavy_hitters, k);
+  }
+
+  void initialize(int width, int seed, PageMode page_mode = default_pages) {
+    this->width = width;
+    this->counter = 0;
+    this->seed = seed;
+
+    assert(width > 0 && "We assume too much!");
+
+    size_t count = Layout::counter_count(width, Depth);
+    void *memory = storage.allocate(
+        (count * sizeof(CounterT) + sizeof(uint32_t) - 1) / sizeof(uint32_t),
+        page_mode);
+    counters = (CounterT *)memory;
+
+    uint32_t seeds[Depth];
+    for (int i = 0; i < Depth; ++i) {
+      seeds[i] = family_seed(Layout::seed_family, seed, i);
+    }
+    hash.initialize(seeds, Depth);
+  }
+
+  void increment(const char *str) {
+    packet_indexes(str, indexes);
+    increment_indexes(str, indexes);
+  }
+
+  void increment_batch(const char *packets, size_t n) {
+    for (size_t start = 0; start < n; start += INCREMENT_BATCH) {
+      size_t block = std::min(n - start, (size_t)INCREMENT_BATCH);
+      const char *block_packets = packets + start * FT_SIZE;
+
+      for (size_t j = 0; j < block; ++j) {
+        uint32_t *block_indexes = indexes + j * Depth;
+        packet_indexes(block_packets + j * FT_SIZE, block_indexes);
+        for (int i = 0; i < Depth; ++i) {
+          __builtin_prefetch(&counters[block_indexes[i]], 1);
+        }
+      }
+
+      for (size_t j = 0; j < block; ++j) {
+        increment_indexes(block_packets + j * FT_SIZE, indexes + j * Depth);
+      }
+    }
+  }
+
+  uint64_t query(const char *str) {
+    packet_indexes(str, indexes);
+    return query_indexes(indexes);
+  }
+
+  uint64_t increment_and_query(const char *str) {
+    packet_indexes(str, indexes);
+    increment_indexes(str, indexes);
+    return query_indexes(indexes);
+  }
+
+  uint64_t increment_and_query(const char *str, HashCache *cache) {
+    const uint *hashes =
+        cache->get(Layout::seed_family, seed, Hash::family, Depth);
+    for (int i = 0; i < Depth; ++i) {
+      indexes[i] = Layout::index(hashes[i], i, width);
+    }
+    increment_indexes(str, indexes);
+    return query_indexes(indexes);
+  }
+
+  double estimate_skew() {
+    return estimate_topk_skew(this->skew_estimator, this->counter,
+                              *this->topK);
+  }
+
+  double sketch_error(double alpha, long total, int mem) {
+    uint32_t threshold = (uint32_t)(alpha * (double)total / (double)mem);
+    return Layout::failure_probability(counters, width, Depth, threshold);
+  }
+
+  int get_hash_function_count() { return Depth; }
+};
+
+template <template <int> class Layout, int Depth>
+EvaluatableSketch *make_count_min_with_depth(int k, int width, int seed,
+                                             PageMode page_mode) {
+  CountMin<Layout<runtime_width>, Depth> *sketch =
+      new CountMin<Layout<runtime_width>, Depth>(k);
+  sketch->initialize(width, seed, page_mode);
+  return sketch;
+}
+
+template <template <int> class Layout>
+EvaluatableSketch *make_count_min_with_hash_count(int k, int width,
+                                                  int hash_count, int seed,
+                                                  PageMode page_mode) {
+  switch (hash_count) {
+  case 1:
+    return make_count_min_with_depth<Layout, 1>(k, width, seed, page_mode);
+  case 2:
+    return make_count_min_with_depth<Layout, 2>(k, width, seed, page_mode);
+  case 3:
+    return make_count_min_with_depth<Layout, 3>(k, width, seed, page_mode);
+  case 4:
+    return make_count_min_with_depth<Layout, 4>(k, width, seed, page_mode);
+  case 5:
+    return make_count_min_with_depth<Layout, 5>(k, width, seed, page_mode);
+  case 6:
+    return make_count_min_with_depth<Layout, 6>(k, width, seed, page_mode);
+  case 7:
+    return make_count_min_with_depth<Layout, 7>(k, width, seed, page_mode);
+  case 8:
+    return make_count_min_with_depth<Layout, 8>(k, width, seed, page_mode);
+  case 9:
+    return make_count_min_with_depth<Layout, 9>(k, width, seed, page_mode);
+  case 10:
+    return make_count_min_with_depth<Layout, 10>(k, width, seed, page_mode);
+  }
+  throw std::runtime_error("Unsupported hash function count");
+}
+
+/// The specialised equivalent of `CountMinFlat` for 1 to 10 hash functions.
+inline EvaluatableSketch *
+make_flat_count_min(int k, int width, int hash_count, int seed,
+                    PageMode page_mode = default_pages) {
+  return make_count_min_with_hash_count<FlatLayout>(k, width, hash_count, seed,
+                                                    page_mode);
+}
+
+/// The specialised equivalent of `CountMinTopK` for 1 to 10 hash functions.
+inline EvaluatableSketch *
+make_row_count_min(int k, int width, int hash_count, int seed,
+                   PageMode page_mode = default_pages) {
+  return make_count_min_with_hash_count<RowLayout>(k, width, hash_count, seed,
+                                                   page_mode);
+}
@@ -0,0 +1,97 @@
+#include "counter_storage.hpp"
+
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+const size_t CACHE_LINE_SIZE = 64;
+
+std::string page_mode_name(PageMode mode) {
+  switch (mode) {
+  case default_pages:
+    return "default";
+  case transparent_huge_pages:
+    return "transparent huge pages";
+  case explicit_huge_pages:
+    return "explicit huge pages";
+  }
+  throw std::runtime_error("invalid page mode");
+}
+
+CounterStorage::CounterStorage() {
+  this->memory = nullptr;
+  this->mapping = nullptr;
+  this->mapping_bytes = 0;
+  this->mode = default_pages;
+}
+
+CounterStorage::~CounterStorage() { this->release(); }
+
+void CounterStorage::release() {
+  if (this->mapping != nullptr) {
+    munmap(this->mapping, this->mapping_bytes);
+  } else {
+    free(this->memory);
+  }
+
+  this->memory = nullptr;
+  this->mapping = nullptr;
+  this->mapping_bytes = 0;
+}
+
+uint32_t *CounterStorage::allocate(size_t count, PageMode mode) {
+  this->release();
+  this->mode = mode;
+
+  size_t bytes = count * sizeof(uint32_t);
+  size_t huge_bytes = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE *
+                      HUGE_PAGE_SIZE;
+
+  if (mode == explicit_huge_pages) {
+    void *mapped = mmap(nullptr, huge_bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (mapped != MAP_FAILED) {
+      this->mapping = mapped;
+      this->mapping_bytes = huge_bytes;
+      this->memory = mapped;
+      return (uint32_t *)this->memory;
+    }
+
+    printf("No explicit huge pages available, falling back to transparent "
+           "huge pages\n");
+    this->mode = transparent_huge_pages;
+  }
+
+  if (this->mode == transparent_huge_pages) {
+    // Over-allocate so that the counters can start on a 2 MB boundary, which
+    // is required for the kernel to back them with huge pages.
+    size_t mapped_bytes = huge_bytes + HUGE_PAGE_SIZE;
+    void *mapped = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+      throw std::runtime_error("Failed to map sketch counters");
+    }
+
+    uintptr_t start = ((uintptr_t)mapped + HUGE_PAGE_SIZE - 1) /
+                      HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+#ifdef MADV_HUGEPAGE
+    madvise((void *)start, huge_bytes, MADV_HUGEPAGE);
+#endif
+
+    this->mapping = mapped;
+    this->mapping_bytes = mapped_bytes;
+    this->memory = (void *)start;
+    return (uint32_t *)this->memory;
+  }
+
+  if (posix_memalign(&this->memory, CACHE_LINE_SIZE, bytes) != 0) {
+    this->memory = nullptr;
+    throw std::runtime_error("Failed to allocate sketch counters");
+  }
+  memset(this->memory, 0, bytes);
+
+  return (uint32_t *)this->memory;
+}
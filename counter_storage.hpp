@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/*
+ * Backing memory for the counters of the sketches: one contiguous, zeroed and
+ * 64 byte aligned allocation, optionally on 2 MB huge pages.
+ */
+
+enum PageMode {
+  // Regular (4 KB) pages.
+  default_pages = 0,
+  // A 2 MB aligned anonymous mapping advised with MADV_HUGEPAGE so that
+  // transparent huge pages can back it.
+  transparent_huge_pages = 1,
+  // A MAP_HUGETLB mapping from the reserved huge page pool. If the pool is empty
+  // this falls back to transparent huge pages.
+  explicit_huge_pages = 2,
+};
+
+std::string page_mode_name(PageMode mode);
+
+class CounterStorage {
+  void *memory;
+  void *mapping;
+  size_t mapping_bytes;
+
+public:
+  CounterStorage();
+  ~CounterStorage();
+
+  // Returns `count` zeroed counters, replacing any previous allocation.
+  uint32_t *allocate(size_t count, PageMode mode);
+  void release();
+
+  PageMode mode;
+};
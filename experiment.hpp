@@ -23,7 +23,7 @@ void run_experiment_fixed_mem(char *zipfPath, FILE *results, int hashFunctions,
   alpha *= exp(1.0);
 
   HashPacketCounter counter = HashPacketCounter(1 << 27);
-  auto true_top_k = TopK(1000);
+  TopK true_top_k(1000);
 
   ZipfReader *reader = new ZipfReader(zipfPath);
   CountMinBaselineFlexibleWidth sketch = CountMinBaselineFlexibleWidth();
@@ -33,20 +33,7 @@ void run_experiment_fixed_mem(char *zipfPath, FILE *results, int hashFunctions,
   long long sum_sq_err = 0;
   long long n = 0;
 
-  while (true) {
-    char dest[FT_SIZE] = {};
-    int ret = reader->read_next_packet(dest);
-
-    // Reached end
-    if (ret < FT_SIZE) {
-      break;
-    }
-
-    if (ret != FT_SIZE) {
-      throw std::runtime_error(
-          "Failed sanity check - read incorrect number of bytes");
-    }
-
+  for (char *dest : TracePackets(reader)) {
     sketch.increment(dest);
     int actual = counter.increment(dest);
     int countMin = sketch.query(dest);
@@ -118,20 +105,7 @@ void run_experiment(char *zipfPath, const char *resultsPath,
 
     long n = 0;
 
-    while (true) {
-      char dest[FT_SIZE] = {};
-      int ret = reader->read_next_packet(dest);
-
-      // Reached end
-      if (ret < FT_SIZE) {
-        break;
-      }
-
-      if (ret != FT_SIZE) {
-        throw std::runtime_error(
-            "Failed sanity check - read incorrect number of bytes");
-      }
-
+    for (char *dest : TracePackets(reader)) {
       sketch->increment(dest);
       int actual = counter->increment(dest);
       int countMin = sketch->query(dest);
@@ -168,20 +142,7 @@ void run_experiment_top_k(FILE *frequency_f, FILE *cost_f,
   sketch->initialize(width, hashFunctions, 40);
 
   int total = 0;
-  while (true) {
-    char dest[FT_SIZE] = {};
-    int ret = reader->read_next_packet(dest);
-
-    // Reached end
-    if (ret < FT_SIZE) {
-      break;
-    }
-
-    if (ret != FT_SIZE) {
-      throw std::runtime_error(
-          "Failed sanity check - read incorrect number of bytes");
-    }
-
+  for (char *dest : TracePackets(reader)) {
     sketch->increment(dest);
     int actual = counter->increment(dest);
     int countMin = sketch->query(dest);
@@ -197,7 +158,7 @@ void run_experiment_top_k(FILE *frequency_f, FILE *cost_f,
   auto topK = sketch->topK->items();
 
   double estimated_skew =
-      binary_search_estimate_skew(total, k, topK.begin(), topK.end());
+      binary_search_estimate_skew(total, k, topK.rbegin(), topK.rend());
   printf("estimated skew: %f\n", estimated_skew);
 
   fprintf(frequency_f, "index,count,key,frequency\n");
@@ -208,11 +169,13 @@ void run_experiment_top_k(FILE *frequency_f, FILE *cost_f,
   int skew_start = 5;
   int skew_end = 15;
 
+  double costs[MAX_SKEW_CANDIDATES];
+  cost_topk_skews(total, k, 0.1 * skew_start, 0.1, skew_end - skew_start + 1,
+                  topK.rbegin(), topK.rend(), costs);
+
   fprintf(cost_f, "skew,cost\n");
   for (int skew = skew_start; skew <= skew_end; skew++) {
-    double cost =
-        cost_topk_skew(total, k, (double)skew * 0.1, topK.begin(), topK.end());
-    fprintf(cost_f, "%.1f,%f\n", 0.1 * (float)skew, cost);
+    fprintf(cost_f, "%.1f,%f\n", 0.1 * (float)skew, costs[skew - skew_start]);
   }
 }
 
@@ -226,20 +189,7 @@ void run_experiment_flat_top_k(FILE *skew_estimate, char *zipfPath, int mem,
 
   int next_check = 1;
   int i = 0;
-  while (true) {
-    char dest[FT_SIZE] = {};
-    int ret = reader->read_next_packet(dest);
-
-    // Reached end
-    if (ret < FT_SIZE) {
-      break;
-    }
-
-    if (ret != FT_SIZE) {
-      throw std::runtime_error(
-          "Failed sanity check - read incorrect number of bytes");
-    }
-
+  for (char *dest : TracePackets(reader)) {
     sketch->increment(dest);
 
     if (i == next_check) {
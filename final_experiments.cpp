@@ -1,142 +1,99 @@
 #include "final_experiments.hpp"
+#include "indexed_trace.hpp"
+#include "prefetching_reader.hpp"
+
+#include <climits>
+#include <stdexcept>
 
 /*
  * Experiments used in the final dissertation
  */
 
-enum Variant { Flat, Traditional };
-
-class SketchEvaluation {
-public:
-  EvaluatableSketch *sketch;
-  Variant variant;
-  string variant_name;
-  double sum_sq_err;
-
-  SketchEvaluation(EvaluatableSketch *sketch, Variant variant) {
-    this->sketch = sketch;
-    this->variant = variant;
-    this->sum_sq_err = 0.0;
-
-    if (variant == Flat) {
-      variant_name = "flat";
-    } else {
-      variant_name = "traditional";
-    }
-  }
-
-  void handle_packet(char *packet, int actual, double seen_packets) {
-    this->sketch->increment(packet);
-    int estimate = sketch->query(packet);
-    double diff = estimate - actual;
-    this->sum_sq_err += diff * diff;
-  }
-
-  int get_hash_function_count() {
-    return this->sketch->get_hash_function_count();
+// The exact counts of a synthetic trace, sized from the index of an indexed
+// trace (heavy_hitter_err looks at up to 10 ids past the largest).
+static PacketCounter *new_packet_counter(char *trace_path) {
+  int domain = trace_key_domain(trace_path);
+  if (domain > 0 && domain <= INT_MAX - 16) {
+    return new PacketCounter(domain + 16);
   }
+  return new PacketCounter(1 << 28);
+}
 
-  double normalized_error(double total) {
-    double inv_n = 1.0 / total;
-    double error = sqrt(this->sum_sq_err / total) / total;
-
-    return error;
+// Closes the trace once every packet was read, for the prefetching readers
+// first reporting how long the sketches waited on I/O.
+static void close_trace_reader(PacketReader *reader) {
+  PrefetchingTraceReader *prefetching =
+      dynamic_cast<PrefetchingTraceReader *>(reader);
+  if (prefetching != nullptr) {
+    printf("waited %f seconds for trace reads in %ld stalls, the I/O thread "
+           "was idle for %f seconds%s\n",
+           prefetching->stall_seconds(), prefetching->stall_count(),
+           prefetching->io_idle_seconds(),
+           prefetching->is_direct() ? " (O_DIRECT)" : "");
   }
+  delete reader;
+}
 
-  double heavy_hitter_err_real_world(TopK trueTopK, int threshold, long total) {
-    auto items = trueTopK.items();
-    long double heavy_hitter_sq_sum_err = 0.0;
-    int heavy_hitters = 0;
-    for (auto it = --items.end(); it >= items.begin(); --it) {
-      uint32_t actual = it->second;
-      char *packet = it->first.data();
-
-      if (actual < threshold) {
-        break;
-      }
-
-      int estimate = sketch->query(packet);
-      long double err =
-          ((long double)actual - (long double)estimate) / (long double)total;
-
-      heavy_hitters++;
-      heavy_hitter_sq_sum_err += err * err;
-    }
-
-    if (heavy_hitters == 0) {
-      return 0.0;
-    }
-
-    return sqrt(heavy_hitter_sq_sum_err / (long double)heavy_hitters);
+// The results file of the conservative sketch, NULL when it is not run.
+static FILE *open_conservative_results(const ExperimentOptions &options) {
+  if (options.conservative_results_path == NULL) {
+    return NULL;
   }
-
-  double heavy_hitter_err(PacketCounter *counter, int threshold, long total) {
-    char *packet = new char[FT_SIZE];
-    packet[12] = (char)255;
-    long double heavy_hitter_sq_sum_err = 0.0;
-    int less_than_threshold = 0;
-    int packet_index = 1;
-    int heavy_hitters = 0;
-    // After seeing 10 entries less than the threshold we assume there won't be
-    // any more (the loop is in order of decreasing expected frequency).
-    while (less_than_threshold < 10) {
-      int *packetCast = (int *)packet;
-
-      packetCast[0] = packet_index;
-      packetCast[1] = packet_index;
-      packetCast[2] = packet_index;
-
-      int actual = counter->query_index(packet_index);
-      packet_index++;
-
-      if (actual < threshold) {
-        less_than_threshold++;
-        continue;
-      } else if (less_than_threshold > 0) {
-        printf("Less than threshold: %d, but current frequency %d is greater "
-               "than limit %d\n",
-               less_than_threshold, actual, threshold);
-      }
-
-      int estimate = sketch->query(packet);
-
-      long double err =
-          ((long double)actual - (long double)estimate) / (long double)total;
-      heavy_hitters++;
-      heavy_hitter_sq_sum_err += err * err;
-    }
-
-    if (heavy_hitters == 0) {
-      return 0.0;
-    }
-
-    return sqrt(heavy_hitter_sq_sum_err / (long double)heavy_hitters);
+  FILE *results = fopen(options.conservative_results_path, "w");
+  if (results == NULL) {
+    throw std::runtime_error(std::string("Failed to open ") +
+                             options.conservative_results_path);
   }
-};
+  return results;
+}
 
-void baseline_performance_fixed_mem_synthetic(int mem, char *trace_path,
-                                              FILE *flat_results,
-                                              FILE *traditional_results,
-                                              FILE *skew_estimation) {
+void baseline_performance_fixed_mem_synthetic(
+    int mem, char *trace_path, FILE *flat_results, FILE *traditional_results,
+    FILE *blocked_results, FILE *skew_estimation,
+    const ExperimentOptions &options) {
   const int k = 100;
-  PacketCounter *counter = new PacketCounter(1 << 28);
+  PacketCounter *counter = new_packet_counter(trace_path);
   vector<SketchEvaluation *> variants{};
+  FILE *conservative_results = open_conservative_results(options);
 
   const double e = exp(1.0);
 
-  variants.reserve(24);
+  variants.reserve(27);
 
   for (int i = 1; i < 10; i++) {
-    CountMinFlat *flat = new CountMinFlat(k);
-    flat->initialize(mem, i, 10);
+    CountMinFlat *flat = new CountMinFlat(k, options.heavy_hitters);
+    flat->initialize(mem, i, 10, per_row_hash, default_pages,
+                     options.hash_family);
     variants.push_back(new SketchEvaluation(flat, Flat));
 
-    CountMinTopK *regular = new CountMinTopK(k);
-    regular->initialize(mem / i, i, 10);
+    CountMinTopK *regular = new CountMinTopK(k, options.heavy_hitters);
+    regular->initialize(mem / i, i, 10, default_pages, options.hash_family);
     variants.push_back(new SketchEvaluation(regular, Traditional));
+
+    if (blocked_results != NULL) {
+      CountMinBlocked *blocked = new CountMinBlocked(k, options.heavy_hitters);
+      blocked->initialize(mem, i, 10, default_pages, options.hash_family);
+      variants.push_back(new SketchEvaluation(blocked, Blocked));
+    }
+
+    if (conservative_results != NULL) {
+      CountMinConservative *conservative =
+          new CountMinConservative(k, options.heavy_hitters);
+      conservative->initialize(mem, i, 10, per_row_hash, default_pages,
+                               options.hash_family);
+      variants.push_back(new SketchEvaluation(conservative, Conservative));
+    }
+  }
+
+  for (auto variant : variants) {
+    variant->sketch->set_skew_estimator(options.skew_estimator);
   }
 
-  ZipfReader *reader = new ZipfReader(trace_path);
+  PacketReader *reader = open_trace_reader(trace_path, options.trace_reader);
+
+  // Every sketch is seeded with 10, so the packet's hashes are shared.
+  HashCache cache;
+  cache.initialize(10, 9, options.hash_family);
 
   long long sum_sq_err = 0;
   long total = 0;
@@ -145,25 +102,14 @@ void baseline_performance_fixed_mem_synthetic(int mem, char *trace_path,
   fprintf(skew_estimation,
           "variant,hash functions,packets read,skew estimate\n");
 
-  while (true) {
-    char dest[FT_SIZE] = {};
-    int ret = reader->read_next_packet(dest);
-
-    // Reached end
-    if (ret < FT_SIZE) {
-      break;
-    }
-
-    if (ret != FT_SIZE) {
-      throw std::runtime_error(
-          "Failed sanity check - read incorrect number of bytes");
-    }
+  for (char *dest : TracePackets(reader)) {
     total++;
 
     int actual = counter->increment(dest);
+    cache.set_packet(dest);
 
     for (auto variant : variants) {
-      variant->handle_packet(dest, actual, total);
+      variant->handle_packet(dest, actual, total, &cache);
       if (total == next_estimation_index) {
         double skew_estimate = variant->sketch->estimate_skew();
         fprintf(skew_estimation, "%s,%d,%ld,%f\n",
@@ -177,6 +123,8 @@ void baseline_performance_fixed_mem_synthetic(int mem, char *trace_path,
     }
   }
 
+  close_trace_reader(reader);
+
   printf("calculating error stats for trace %s\n", trace_path);
 
   fprintf(flat_results,
@@ -185,6 +133,16 @@ void baseline_performance_fixed_mem_synthetic(int mem, char *trace_path,
   fprintf(traditional_results,
           "hash functions,normalized error,heavy hitter error,sketch error "
           "e,sketch error 2e,sketch error 4e,sketch error 8e\n");
+  if (blocked_results != NULL) {
+    fprintf(blocked_results,
+            "hash functions,normalized error,heavy hitter error,sketch error "
+            "e,sketch error 2e,sketch error 4e,sketch error 8e\n");
+  }
+  if (conservative_results != NULL) {
+    fprintf(conservative_results,
+            "hash functions,normalized error,heavy hitter error,sketch error "
+            "e,sketch error 2e,sketch error 4e,sketch error 8e\n");
+  }
 
   // set phi=0.1%
   int heavy_hitter_threshold = (int)(0.001 * (double)total);
@@ -208,6 +166,10 @@ void baseline_performance_fixed_mem_synthetic(int mem, char *trace_path,
     FILE *results_output = flat_results;
     if (variant->variant == Traditional) {
       results_output = traditional_results;
+    } else if (variant->variant == Blocked) {
+      results_output = blocked_results;
+    } else if (variant->variant == Conservative) {
+      results_output = conservative_results;
     }
 
     fprintf(results_output, "%d,%E,%E,%E,%E,%E,%E\n", hash_functions,
@@ -217,33 +179,64 @@ void baseline_performance_fixed_mem_synthetic(int mem, char *trace_path,
 
   fclose(flat_results);
   fclose(traditional_results);
+  if (blocked_results != NULL) {
+    fclose(blocked_results);
+  }
+  if (conservative_results != NULL) {
+    fclose(conservative_results);
+  }
 }
 
-void baseline_performance_fixed_mem_real_world(int mem, char *trace_path,
-                                               FILE *flat_results,
-                                               FILE *traditional_results,
-                                               FILE *skew_estimation) {
+void baseline_performance_fixed_mem_real_world(
+    int mem, char *trace_path, FILE *flat_results, FILE *traditional_results,
+    FILE *blocked_results, FILE *skew_estimation,
+    const ExperimentOptions &options) {
   const int k = 100;
   HashPacketCounter *counter = new HashPacketCounter(1 << 28);
+  counter->reserve(trace_distinct_keys(trace_path));
   vector<SketchEvaluation *> variants{};
+  FILE *conservative_results = open_conservative_results(options);
 
-  TopK trueTopK = TopK(2000);
+  HeavyHitters *trueTopK = make_heavy_hitters(options.heavy_hitters, 2000);
 
   const double e = exp(1.0);
 
-  variants.reserve(24);
+  variants.reserve(27);
 
   for (int i = 1; i < 10; i++) {
-    CountMinFlat *flat = new CountMinFlat(k);
-    flat->initialize(mem, i, 10);
+    CountMinFlat *flat = new CountMinFlat(k, options.heavy_hitters);
+    flat->initialize(mem, i, 10, per_row_hash, default_pages,
+                     options.hash_family);
     variants.push_back(new SketchEvaluation(flat, Flat));
 
-    CountMinTopK *regular = new CountMinTopK(k);
-    regular->initialize(mem / i, i, 10);
+    CountMinTopK *regular = new CountMinTopK(k, options.heavy_hitters);
+    regular->initialize(mem / i, i, 10, default_pages, options.hash_family);
     variants.push_back(new SketchEvaluation(regular, Traditional));
+
+    if (blocked_results != NULL) {
+      CountMinBlocked *blocked = new CountMinBlocked(k, options.heavy_hitters);
+      blocked->initialize(mem, i, 10, default_pages, options.hash_family);
+      variants.push_back(new SketchEvaluation(blocked, Blocked));
+    }
+
+    if (conservative_results != NULL) {
+      CountMinConservative *conservative =
+          new CountMinConservative(k, options.heavy_hitters);
+      conservative->initialize(mem, i, 10, per_row_hash, default_pages,
+                               options.hash_family);
+      variants.push_back(new SketchEvaluation(conservative, Conservative));
+    }
+  }
+
+  for (auto variant : variants) {
+    variant->sketch->set_skew_estimator(options.skew_estimator);
   }
 
-  ZipfReader *reader = new ZipfReader(trace_path);
+  PacketReader *reader = open_trace_reader(trace_path, options.trace_reader);
+
+  // Every sketch is seeded with 10, so the packet's hashes are shared.
+  HashCache cache;
+  cache.initialize(10, 9, options.hash_family);
 
   long long sum_sq_err = 0;
   long total = 0;
@@ -253,26 +246,15 @@ void baseline_performance_fixed_mem_real_world(int mem, char *trace_path,
   fprintf(skew_estimation,
           "variant,hash functions,packets read,skew estimate\n");
 
-  while (true) {
-    char dest[FT_SIZE] = {};
-    int ret = reader->read_next_packet(dest);
-
-    // Reached end
-    if (ret < FT_SIZE) {
-      break;
-    }
-
-    if (ret != FT_SIZE) {
-      throw std::runtime_error(
-          "Failed sanity check - read incorrect number of bytes");
-    }
+  for (char *dest : TracePackets(reader)) {
     total++;
 
     int actual = counter->increment(dest);
-    trueTopK.update(dest, actual);
+    trueTopK->update(dest, actual);
+    cache.set_packet(dest);
 
     for (auto variant : variants) {
-      variant->handle_packet(dest, actual, total);
+      variant->handle_packet(dest, actual, total, &cache);
       if (total == next_estimation_index) {
         double skew_estimate = variant->sketch->estimate_skew();
         fprintf(skew_estimation, "%s,%d,%ld,%f\n",
@@ -286,6 +268,8 @@ void baseline_performance_fixed_mem_real_world(int mem, char *trace_path,
     }
   }
 
+  close_trace_reader(reader);
+
   printf("calculating error stats for trace %s\n", trace_path);
 
   fprintf(flat_results,
@@ -294,6 +278,16 @@ void baseline_performance_fixed_mem_real_world(int mem, char *trace_path,
   fprintf(traditional_results,
           "hash functions,normalized error,heavy hitter error,sketch error "
           "e,sketch error 2e,sketch error 4e,sketch error 8e\n");
+  if (blocked_results != NULL) {
+    fprintf(blocked_results,
+            "hash functions,normalized error,heavy hitter error,sketch error "
+            "e,sketch error 2e,sketch error 4e,sketch error 8e\n");
+  }
+  if (conservative_results != NULL) {
+    fprintf(conservative_results,
+            "hash functions,normalized error,heavy hitter error,sketch error "
+            "e,sketch error 2e,sketch error 4e,sketch error 8e\n");
+  }
 
   // set phi=0.1%
   int heavy_hitter_threshold = (int)(0.001 * (double)total);
@@ -304,7 +298,7 @@ void baseline_performance_fixed_mem_real_world(int mem, char *trace_path,
     double normalized_error = variant->normalized_error(total);
 
     double heavy_hitter_err = variant->heavy_hitter_err_real_world(
-        trueTopK, heavy_hitter_threshold, total);
+        *trueTopK, heavy_hitter_threshold, total, counter);
 
     auto sketch = variant->sketch;
     double sketch_error_e = sketch->sketch_error(e, total, mem);
@@ -317,6 +311,10 @@ void baseline_performance_fixed_mem_real_world(int mem, char *trace_path,
     FILE *results_output = flat_results;
     if (variant->variant == Traditional) {
       results_output = traditional_results;
+    } else if (variant->variant == Blocked) {
+      results_output = blocked_results;
+    } else if (variant->variant == Conservative) {
+      results_output = conservative_results;
     }
 
     fprintf(results_output, "%d,%E,%E,%E,%E,%E,%E\n", hash_functions,
@@ -326,14 +324,37 @@ void baseline_performance_fixed_mem_real_world(int mem, char *trace_path,
 
   fclose(flat_results);
   fclose(traditional_results);
+  if (blocked_results != NULL) {
+    fclose(blocked_results);
+  }
+  if (conservative_results != NULL) {
+    fclose(conservative_results);
+  }
+  delete trueTopK;
+}
+
+// A dynamic sketch (seeded with 10) set up with the options of the experiment.
+static DynamicCountMin *
+new_dynamic_count_min(int k, ErrorMetric metric, bool use_bounds,
+                      bool conservative, int mem, int start_hash_functions,
+                      const ExperimentOptions &options) {
+  DynamicCountMin *sketch = new DynamicCountMin(k, metric, use_bounds,
+                                                conservative,
+                                                options.heavy_hitters);
+  sketch->initialize(mem, start_hash_functions, 10, per_row_hash,
+                     default_pages, options.hash_family);
+  if (options.async_reconfigure) {
+    sketch->use_async_reconfigure();
+  }
+  return sketch;
 }
 
 // Tests the performance of the dynamic sketches
-void dynamic_performance_fixed_mem_synthetic(int mem, char *trace_path,
-                                             FILE *results,
-                                             FILE *skew_estimation) {
+void dynamic_performance_fixed_mem_synthetic(
+    int mem, char *trace_path, FILE *results, FILE *skew_estimation,
+    const ExperimentOptions &options) {
   const int k = 100;
-  PacketCounter *counter = new PacketCounter(1 << 28);
+  PacketCounter *counter = new_packet_counter(trace_path);
   vector<SketchEvaluation *> variants{};
 
   const double e = exp(1.0);
@@ -345,22 +366,45 @@ void dynamic_performance_fixed_mem_synthetic(int mem, char *trace_path,
     // Error metrics are numbered 0 to 1 inclusive.
     ErrorMetric metric = (ErrorMetric)i;
 
-    DynamicCountMin *flat_bounds = new DynamicCountMin(k, metric, true);
-    flat_bounds->initialize(mem, start_hash_functions, 10);
+    DynamicCountMin *flat_bounds = new_dynamic_count_min(
+        k, metric, true, false, mem, start_hash_functions, options);
     SketchEvaluation *evaluation_bounds =
         new SketchEvaluation(flat_bounds, Flat);
     evaluation_bounds->variant_name = error_metric_name(metric) + "-bounds";
     variants.push_back(evaluation_bounds);
 
-    DynamicCountMin *flat_lowest = new DynamicCountMin(k, metric, false);
-    flat_lowest->initialize(mem, start_hash_functions, 10);
+    DynamicCountMin *flat_lowest = new_dynamic_count_min(
+        k, metric, false, false, mem, start_hash_functions, options);
     SketchEvaluation *evaluation_lowest =
         new SketchEvaluation(flat_lowest, Flat);
     evaluation_lowest->variant_name = error_metric_name(metric) + "-lowest";
     variants.push_back(evaluation_lowest);
+
+    if (!options.conservative_dynamic) {
+      continue;
+    }
+
+    for (int use_bounds = 1; use_bounds >= 0; use_bounds--) {
+      DynamicCountMin *conservative = new_dynamic_count_min(
+          k, metric, use_bounds, true, mem, start_hash_functions, options);
+      SketchEvaluation *evaluation =
+          new SketchEvaluation(conservative, Conservative);
+      evaluation->variant_name = error_metric_name(metric) +
+                                 (use_bounds ? "-bounds" : "-lowest") +
+                                 "-conservative";
+      variants.push_back(evaluation);
+    }
+  }
+
+  for (auto variant : variants) {
+    variant->sketch->set_skew_estimator(options.skew_estimator);
   }
 
-  ZipfReader *reader = new ZipfReader(trace_path);
+  PacketReader *reader = open_trace_reader(trace_path, options.trace_reader);
+
+  // Every sketch is seeded with 10, so the packet's hashes are shared.
+  HashCache cache;
+  cache.initialize(10, start_hash_functions, options.hash_family);
 
   long long sum_sq_err = 0;
   long total = 0;
@@ -369,25 +413,14 @@ void dynamic_performance_fixed_mem_synthetic(int mem, char *trace_path,
   fprintf(skew_estimation,
           "variant,hash functions,packets read,skew estimate\n");
 
-  while (true) {
-    char dest[FT_SIZE] = {};
-    int ret = reader->read_next_packet(dest);
-
-    // Reached end
-    if (ret < FT_SIZE) {
-      break;
-    }
-
-    if (ret != FT_SIZE) {
-      throw std::runtime_error(
-          "Failed sanity check - read incorrect number of bytes");
-    }
+  for (char *dest : TracePackets(reader)) {
     total++;
 
     int actual = counter->increment(dest);
+    cache.set_packet(dest);
 
     for (auto variant : variants) {
-      variant->handle_packet(dest, actual, total);
+      variant->handle_packet(dest, actual, total, &cache);
       if (total == next_estimation_index) {
         double skew_estimate = variant->sketch->estimate_skew();
         fprintf(skew_estimation, "%s,%d,%ld,%f\n",
@@ -401,10 +434,17 @@ void dynamic_performance_fixed_mem_synthetic(int mem, char *trace_path,
     }
   }
 
+  close_trace_reader(reader);
+
   printf("calculating error stats for trace %s\n", trace_path);
 
   fprintf(results, "variant,normalized error,heavy hitter error,sketch error "
-                   "e,sketch error 2e,sketch error 4e,sketch error 8e\n");
+                   "e,sketch error 2e,sketch error 4e,sketch error 8e");
+  if (options.async_reconfigure) {
+    fprintf(results, ",reconfigure latency seconds,reconfigure latency "
+                     "packets");
+  }
+  fprintf(results, "\n");
 
   // set phi=0.1%
   int heavy_hitter_threshold = (int)(0.001 * (double)total);
@@ -425,21 +465,29 @@ void dynamic_performance_fixed_mem_synthetic(int mem, char *trace_path,
 
     int hash_functions = sketch->get_hash_function_count();
 
-    fprintf(results, "%s,%E,%E,%E,%E,%E,%E\n", variant->variant_name.c_str(),
+    fprintf(results, "%s,%E,%E,%E,%E,%E,%E", variant->variant_name.c_str(),
             normalized_error, heavy_hitter_err, sketch_error_e, sketch_error_2e,
             sketch_error_4e, sketch_error_8e);
+    if (options.async_reconfigure) {
+      // -1 when no decision was applied.
+      DynamicCountMin *dynamic = (DynamicCountMin *)sketch;
+      fprintf(results, ",%E,%d", dynamic->reconfigure_latency_seconds,
+              dynamic->reconfigure_latency_packets);
+    }
+    fprintf(results, "\n");
   }
 
   fclose(results);
 }
 
-void dynamic_performance_fixed_mem_real_world(int mem, char *trace_path,
-                                              FILE *results,
-                                              FILE *skew_estimation) {
+void dynamic_performance_fixed_mem_real_world(
+    int mem, char *trace_path, FILE *results, FILE *skew_estimation,
+    const ExperimentOptions &options) {
 
   const int k = 100;
   HashPacketCounter *counter = new HashPacketCounter(1 << 28);
-  TopK trueTopK = TopK(2000);
+  counter->reserve(trace_distinct_keys(trace_path));
+  HeavyHitters *trueTopK = make_heavy_hitters(options.heavy_hitters, 2000);
 
   // PacketCounter *counter = new PacketCounter(1 << 28);
   vector<SketchEvaluation *> variants{};
@@ -453,22 +501,45 @@ void dynamic_performance_fixed_mem_real_world(int mem, char *trace_path,
     // Error metrics are numbered 0 to 1 inclusive.
     ErrorMetric metric = (ErrorMetric)i;
 
-    DynamicCountMin *flat_bounds = new DynamicCountMin(k, metric, true);
-    flat_bounds->initialize(mem, start_hash_functions, 10);
+    DynamicCountMin *flat_bounds = new_dynamic_count_min(
+        k, metric, true, false, mem, start_hash_functions, options);
     SketchEvaluation *evaluation_bounds =
         new SketchEvaluation(flat_bounds, Flat);
     evaluation_bounds->variant_name = error_metric_name(metric) + "-bounds";
     variants.push_back(evaluation_bounds);
 
-    DynamicCountMin *flat_lowest = new DynamicCountMin(k, metric, false);
-    flat_lowest->initialize(mem, start_hash_functions, 10);
+    DynamicCountMin *flat_lowest = new_dynamic_count_min(
+        k, metric, false, false, mem, start_hash_functions, options);
     SketchEvaluation *evaluation_lowest =
         new SketchEvaluation(flat_lowest, Flat);
     evaluation_lowest->variant_name = error_metric_name(metric) + "-lowest";
     variants.push_back(evaluation_lowest);
+
+    if (!options.conservative_dynamic) {
+      continue;
+    }
+
+    for (int use_bounds = 1; use_bounds >= 0; use_bounds--) {
+      DynamicCountMin *conservative = new_dynamic_count_min(
+          k, metric, use_bounds, true, mem, start_hash_functions, options);
+      SketchEvaluation *evaluation =
+          new SketchEvaluation(conservative, Conservative);
+      evaluation->variant_name = error_metric_name(metric) +
+                                 (use_bounds ? "-bounds" : "-lowest") +
+                                 "-conservative";
+      variants.push_back(evaluation);
+    }
+  }
+
+  for (auto variant : variants) {
+    variant->sketch->set_skew_estimator(options.skew_estimator);
   }
 
-  ZipfReader *reader = new ZipfReader(trace_path);
+  PacketReader *reader = open_trace_reader(trace_path, options.trace_reader);
+
+  // Every sketch is seeded with 10, so the packet's hashes are shared.
+  HashCache cache;
+  cache.initialize(10, start_hash_functions, options.hash_family);
 
   long long sum_sq_err = 0;
   long total = 0;
@@ -477,26 +548,15 @@ void dynamic_performance_fixed_mem_real_world(int mem, char *trace_path,
   fprintf(skew_estimation,
           "variant,hash functions,packets read,skew estimate\n");
 
-  while (true) {
-    char dest[FT_SIZE] = {};
-    int ret = reader->read_next_packet(dest);
-
-    // Reached end
-    if (ret < FT_SIZE) {
-      break;
-    }
-
-    if (ret != FT_SIZE) {
-      throw std::runtime_error(
-          "Failed sanity check - read incorrect number of bytes");
-    }
+  for (char *dest : TracePackets(reader)) {
     total++;
 
     int actual = counter->increment(dest);
-    trueTopK.update(dest, actual);
+    trueTopK->update(dest, actual);
+    cache.set_packet(dest);
 
     for (auto variant : variants) {
-      variant->handle_packet(dest, actual, total);
+      variant->handle_packet(dest, actual, total, &cache);
       if (total == next_estimation_index) {
         double skew_estimate = variant->sketch->estimate_skew();
         fprintf(skew_estimation, "%s,%d,%ld,%f\n",
@@ -510,10 +570,17 @@ void dynamic_performance_fixed_mem_real_world(int mem, char *trace_path,
     }
   }
 
+  close_trace_reader(reader);
+
   printf("calculating error stats for trace %s\n", trace_path);
 
   fprintf(results, "variant,normalized error,heavy hitter error,sketch error "
-                   "e,sketch error 2e,sketch error 4e,sketch error 8e\n");
+                   "e,sketch error 2e,sketch error 4e,sketch error 8e");
+  if (options.async_reconfigure) {
+    fprintf(results, ",reconfigure latency seconds,reconfigure latency "
+                     "packets");
+  }
+  fprintf(results, "\n");
 
   // set phi=0.1%
   int heavy_hitter_threshold = (int)(0.001 * (double)total);
@@ -524,7 +591,7 @@ void dynamic_performance_fixed_mem_real_world(int mem, char *trace_path,
     double normalized_error = variant->normalized_error(total);
 
     double heavy_hitter_err = variant->heavy_hitter_err_real_world(
-        trueTopK, heavy_hitter_threshold, total);
+        *trueTopK, heavy_hitter_threshold, total, counter);
 
     auto sketch = variant->sketch;
     double sketch_error_e = sketch->sketch_error(e, total, mem);
@@ -534,10 +601,18 @@ void dynamic_performance_fixed_mem_real_world(int mem, char *trace_path,
 
     int hash_functions = sketch->get_hash_function_count();
 
-    fprintf(results, "%s,%E,%E,%E,%E,%E,%E\n", variant->variant_name.c_str(),
+    fprintf(results, "%s,%E,%E,%E,%E,%E,%E", variant->variant_name.c_str(),
             normalized_error, heavy_hitter_err, sketch_error_e, sketch_error_2e,
             sketch_error_4e, sketch_error_8e);
+    if (options.async_reconfigure) {
+      // -1 when no decision was applied.
+      DynamicCountMin *dynamic = (DynamicCountMin *)sketch;
+      fprintf(results, ",%E,%d", dynamic->reconfigure_latency_seconds,
+              dynamic->reconfigure_latency_packets);
+    }
+    fprintf(results, "\n");
   }
 
   fclose(results);
+  delete trueTopK;
 }
@@ -1,23 +1,184 @@
+#pragma once
+
 #include "CMS.hpp"
 #include "Counter.hpp"
 #include "TraceReader.hpp"
 
 using namespace std;
 
-void baseline_performance_fixed_mem_synthetic(int mem, char *trace_path,
-                                              FILE *flat_results,
-                                              FILE *traditional_results,
-                                              FILE *skew_estimation);
+enum Variant { Flat, Traditional, Blocked, Conservative };
+
+/// Options shared by the experiments, selected with `--key=value` flags on the
+/// command line.
+struct ExperimentOptions {
+  // --hash=bob|xxh3|multiply_shift|tabulation|crc32c
+  HashFamily hash_family = bob_hash;
+  // --conservative_results=<csv>, the baseline experiments also run
+  // CountMinConservative and write its results there.
+  const char *conservative_results_path = NULL;
+  // --conservative_dynamic=1, the dynamic experiments also run conservative
+  // update versions of the dynamic sketches.
+  bool conservative_dynamic = false;
+  // --heavy_hitters=heap|stream_summary, the structure the sketches estimate
+  // the skew from. The real-world experiments also use it (rather than exact
+  // counts) to find the heavy hitters the error is measured on.
+  HeavyHitterMode heavy_hitters = top_k_heap;
+  // --skew_estimator=grid|regression|incremental, how the sketches estimate the
+  // skew (including when the dynamic sketches reconfigure).
+  SkewEstimator skew_estimator = grid_skew_estimator;
+  // --async_reconfigure=1, the dynamic sketches decide their configuration on
+  // a background thread rather than stalling the updates. The dynamic results
+  // then also report how long the decision took to apply.
+  bool async_reconfigure = false;
+  // --trace_reader=stream|prefetch|direct|mmap, how the final experiments read
+  // a raw trace (compact traces are always decoded with CompactTraceReader).
+  // The prefetching readers report how long the sketches waited on I/O, mmap
+  // maps the trace and updates the sketches with the packets in place.
+  TraceReaderMode trace_reader = stream_trace_reader;
+};
+
+class SketchEvaluation {
+public:
+  EvaluatableSketch *sketch;
+  Variant variant;
+  string variant_name;
+  double sum_sq_err;
+
+  SketchEvaluation(EvaluatableSketch *sketch, Variant variant) {
+    this->sketch = sketch;
+    this->variant = variant;
+    this->sum_sq_err = 0.0;
+
+    if (variant == Flat) {
+      variant_name = "flat";
+    } else if (variant == Blocked) {
+      variant_name = "blocked";
+    } else if (variant == Conservative) {
+      variant_name = "conservative";
+    } else {
+      variant_name = "traditional";
+    }
+  }
+
+  // When given, `cache` must already be set to `packet`.
+  void handle_packet(char *packet, int actual, double /* seen_packets */,
+                     HashCache *cache = nullptr) {
+    int estimate = cache == nullptr
+                       ? this->sketch->increment_and_query(packet)
+                       : this->sketch->increment_and_query(packet, cache);
+    double diff = estimate - actual;
+    this->sum_sq_err += diff * diff;
+  }
+
+  int get_hash_function_count() {
+    return this->sketch->get_hash_function_count();
+  }
+
+  double normalized_error(double total) {
+    double error = sqrt(this->sum_sq_err / total) / total;
+
+    return error;
+  }
+
+  // `trueTopK` picks the heavy hitters. Its counts are taken as exact unless
+  // `counter` is given, which then gives the exact counts (Space-Saving only
+  // bounds them from above).
+  double heavy_hitter_err_real_world(HeavyHitters &trueTopK, int threshold,
+                                     long total,
+                                     HashPacketCounter *counter = nullptr) {
+    auto items = trueTopK.items();
+    long double heavy_hitter_sq_sum_err = 0.0;
+    int heavy_hitters = 0;
+    for (auto it = --items.end(); it >= items.begin(); --it) {
+      uint32_t actual = it->second;
+      char *packet = it->first.data();
+
+      if (actual < (uint32_t)threshold) {
+        break;
+      }
+      if (counter != nullptr) {
+        int exact = counter->query(packet);
+        if (exact < threshold) {
+          continue;
+        }
+        actual = exact;
+      }
+
+      int estimate = sketch->query(packet);
+      long double err =
+          ((long double)actual - (long double)estimate) / (long double)total;
+
+      heavy_hitters++;
+      heavy_hitter_sq_sum_err += err * err;
+    }
+
+    if (heavy_hitters == 0) {
+      return 0.0;
+    }
+
+    return sqrt(heavy_hitter_sq_sum_err / (long double)heavy_hitters);
+  }
+
+  double heavy_hitter_err(PacketCounter *counter, int threshold, long total) {
+    char *packet = new char[FT_SIZE];
+    packet[12] = (char)255;
+    long double heavy_hitter_sq_sum_err = 0.0;
+    int less_than_threshold = 0;
+    int packet_index = 1;
+    int heavy_hitters = 0;
+    // After seeing 10 entries less than the threshold we assume there won't be
+    // any more (the loop is in order of decreasing expected frequency).
+    while (less_than_threshold < 10) {
+      int *packetCast = (int *)packet;
+
+      packetCast[0] = packet_index;
+      packetCast[1] = packet_index;
+      packetCast[2] = packet_index;
+
+      int actual = counter->query_index(packet_index);
+      packet_index++;
+
+      if (actual < threshold) {
+        less_than_threshold++;
+        continue;
+      } else if (less_than_threshold > 0) {
+        printf("Less than threshold: %d, but current frequency %d is greater "
+               "than limit %d\n",
+               less_than_threshold, actual, threshold);
+      }
+
+      int estimate = sketch->query(packet);
+
+      long double err =
+          ((long double)actual - (long double)estimate) / (long double)total;
+      heavy_hitters++;
+      heavy_hitter_sq_sum_err += err * err;
+    }
+
+    if (heavy_hitters == 0) {
+      return 0.0;
+    }
+
+    return sqrt(heavy_hitter_sq_sum_err / (long double)heavy_hitters);
+  }
+};
+
+// `blocked_results` may be NULL, in which case the blocked sketch is not run.
+void baseline_performance_fixed_mem_synthetic(
+    int mem, char *trace_path, FILE *flat_results, FILE *traditional_results,
+    FILE *blocked_results, FILE *skew_estimation,
+    const ExperimentOptions &options = ExperimentOptions());
 
-void dynamic_performance_fixed_mem_synthetic(int mem, char *trace_path,
-                                             FILE *results,
-                                             FILE *skew_estimation);
+void dynamic_performance_fixed_mem_synthetic(
+    int mem, char *trace_path, FILE *results, FILE *skew_estimation,
+    const ExperimentOptions &options = ExperimentOptions());
 
-void baseline_performance_fixed_mem_real_world(int mem, char *trace_path,
-                                               FILE *flat_results,
-                                               FILE *traditional_results,
-                                               FILE *skew_estimation);
+// `blocked_results` may be NULL, in which case the blocked sketch is not run.
+void baseline_performance_fixed_mem_real_world(
+    int mem, char *trace_path, FILE *flat_results, FILE *traditional_results,
+    FILE *blocked_results, FILE *skew_estimation,
+    const ExperimentOptions &options = ExperimentOptions());
 
-void dynamic_performance_fixed_mem_real_world(int mem, char *trace_path,
-                                              FILE *results,
-                                              FILE *skew_estimation);
+void dynamic_performance_fixed_mem_real_world(
+    int mem, char *trace_path, FILE *results, FILE *skew_estimation,
+    const ExperimentOptions &options = ExperimentOptions());
@@ -0,0 +1,216 @@
+#include "hash_family.hpp"
+
+#include <assert.h>
+#include <stdexcept>
+#include <string.h>
+
+#include "xxhash.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HASH_FAMILY_SSE42
+#include <immintrin.h>
+#endif
+
+// The random 64 bit words each hash function of a family keeps. Multiply-shift
+// uses all of them (four word multipliers and the offset), XXH3 only the
+// first (its seed) and CRC32C the first two (the remix multiplier and offset).
+const int SEED_WORDS = 5;
+
+std::string hash_family_name(HashFamily family) {
+  switch (family) {
+  case bob_hash:
+    return "bob";
+  case xxh3_hash:
+    return "xxh3";
+  case multiply_shift_hash:
+    return "multiply_shift";
+  case tabulation_hash:
+    return "tabulation";
+  case crc32c_hash:
+    return "crc32c";
+  }
+  throw std::runtime_error("invalid hash family");
+}
+
+HashFamily parse_hash_family(const char *name) {
+  for (int i = 0; i < HASH_FAMILY_COUNT; i++) {
+    if (hash_family_name((HashFamily)i) == name) {
+      return (HashFamily)i;
+    }
+  }
+  throw std::runtime_error(std::string("Unknown hash family ") + name);
+}
+
+// SplitMix64, used to expand the small BobHash seeds into random words.
+static uint64_t split_mix(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// The key as four little endian 32 bit words, zero padded.
+static inline void key_words(const char *str, uint64_t *words) {
+  uint32_t padded[4] = {};
+  memcpy(padded, str, FT_SIZE);
+  for (int i = 0; i < 4; i++) {
+    words[i] = padded[i];
+  }
+}
+
+static uint32_t crc32c_table[256];
+
+static void crc32c_init_table() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+    }
+    crc32c_table[i] = crc;
+  }
+}
+
+static uint32_t crc32c_scalar(const char *str) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (int i = 0; i < FT_SIZE; i++) {
+    crc = crc32c_table[(crc ^ (uint8_t)str[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#ifdef HASH_FAMILY_SSE42
+
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_sse42(const char *str) {
+  uint64_t first;
+  uint32_t second;
+  memcpy(&first, str, 8);
+  memcpy(&second, str + 8, 4);
+
+  uint64_t crc = _mm_crc32_u64(0xFFFFFFFF, first);
+  uint32_t crc32 = _mm_crc32_u32((uint32_t)crc, second);
+  return _mm_crc32_u8(crc32, (uint8_t)str[12]);
+}
+
+static bool crc32c_use_sse42() {
+  static bool supported = __builtin_cpu_supports("sse4.2");
+  return supported;
+}
+
+#endif
+
+static inline uint32_t crc32c(const char *str) {
+  static_assert(FT_SIZE == 13, "crc32c assumes 13 byte packets");
+#ifdef HASH_FAMILY_SSE42
+  if (crc32c_use_sse42()) {
+    return crc32c_sse42(str);
+  }
+#endif
+  return crc32c_scalar(str);
+}
+
+PacketHasher::PacketHasher() {
+  this->family = bob_hash;
+  this->count = 0;
+  this->bobhash = nullptr;
+  this->seeds = nullptr;
+  this->tables = nullptr;
+}
+
+PacketHasher::~PacketHasher() {
+  delete[] bobhash;
+  delete[] seeds;
+  delete[] tables;
+}
+
+void PacketHasher::initialize(HashFamily family, const uint32_t *bob_seeds,
+                              int count) {
+  this->family = family;
+  this->count = count;
+
+  delete[] bobhash;
+  delete[] seeds;
+  delete[] tables;
+  bobhash = nullptr;
+  seeds = nullptr;
+  tables = nullptr;
+
+  if (family == bob_hash) {
+    bobhash = new BOBHash[count];
+    for (int i = 0; i < count; ++i) {
+      bobhash[i].initialize(bob_seeds[i]);
+    }
+    multi_hash.initialize(bobhash, count);
+    return;
+  }
+
+  seeds = new uint64_t[count * SEED_WORDS];
+  for (int i = 0; i < count; ++i) {
+    uint64_t state = ((uint64_t)bob_seeds[i] << 8) | (uint64_t)family;
+    for (int j = 0; j < SEED_WORDS; ++j) {
+      seeds[i * SEED_WORDS + j] = split_mix(&state);
+    }
+    // The CRC32C remix multiplier has to be odd.
+    seeds[i * SEED_WORDS] |= 1;
+  }
+
+  if (family == tabulation_hash) {
+    tables = new uint32_t[count * FT_SIZE * 256];
+    for (int i = 0; i < count; ++i) {
+      uint64_t state = seeds[i * SEED_WORDS];
+      for (int j = 0; j < FT_SIZE * 256; ++j) {
+        tables[i * FT_SIZE * 256 + j] = (uint32_t)(split_mix(&state) >> 32);
+      }
+    }
+  }
+
+  if (family == crc32c_hash && crc32c_table[1] == 0) {
+    crc32c_init_table();
+  }
+}
+
+void PacketHasher::run(const char *str, uint *out, int count) {
+  assert(count <= this->count && "PacketHasher: more hashes than seeds!");
+
+  switch (family) {
+  case bob_hash:
+    multi_hash.run(str, FT_SIZE, out, count);
+    return;
+  case xxh3_hash:
+    for (int i = 0; i < count; ++i) {
+      out[i] = (uint)XXH3_64bits_withSeed(str, FT_SIZE, seeds[i * SEED_WORDS]);
+    }
+    return;
+  case multiply_shift_hash: {
+    uint64_t x[4];
+    key_words(str, x);
+    for (int i = 0; i < count; ++i) {
+      const uint64_t *a = seeds + i * SEED_WORDS;
+      uint64_t hash = (a[0] + x[0]) * (a[1] + x[1]) +
+                      (a[2] + x[2]) * (a[3] + x[3]) + a[4];
+      out[i] = (uint)(hash >> 32);
+    }
+    return;
+  }
+  case tabulation_hash:
+    for (int i = 0; i < count; ++i) {
+      const uint32_t *table = tables + i * FT_SIZE * 256;
+      uint32_t hash = 0;
+      for (int j = 0; j < FT_SIZE; ++j) {
+        hash ^= table[j * 256 + (uint8_t)str[j]];
+      }
+      out[i] = hash;
+    }
+    return;
+  case crc32c_hash: {
+    // CRCs with different initial values only differ by a constant XOR, so
+    // rather than one CRC per seed the single CRC is remixed per hash.
+    uint64_t crc = crc32c(str);
+    for (int i = 0; i < count; ++i) {
+      const uint64_t *a = seeds + i * SEED_WORDS;
+      out[i] = (uint)((a[0] * crc + a[1]) >> 32);
+    }
+    return;
+  }
+  }
+}
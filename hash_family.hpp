@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include "BobHash.hpp"
+#include "Defs.hpp"
+
+/// The hash functions a sketch can use to index its counters.
+enum HashFamily {
+  // BobHash with one of 1229 primes per seed (the original SALSA hashing).
+  bob_hash = 0,
+  // XXH3-64 with one 64 bit seed per hash function, truncated to 32 bits.
+  xxh3_hash = 1,
+  // Pair multiply-shift over the key as four 32 bit words.
+  multiply_shift_hash = 2,
+  // Simple tabulation, one table of 256 random words per key byte.
+  tabulation_hash = 3,
+  // A single CRC32C of the key (SSE4.2 when available) remixed per hash
+  // function with multiply-shift.
+  crc32c_hash = 4,
+};
+
+const int HASH_FAMILY_COUNT = 5;
+
+std::string hash_family_name(HashFamily family);
+// Parses the short names accepted on the command line (bob, xxh3,
+// multiply_shift, tabulation, crc32c).
+HashFamily parse_hash_family(const char *name);
+
+/// Computes `count` independent hashes of a packet with the chosen family. The
+/// seeds are the same small integers the sketches used for BobHash, so a
+/// sketch is deterministic for a given seed regardless of family.
+class PacketHasher {
+  HashFamily family;
+  int count;
+
+  BOBHash *bobhash;
+  BOBHashMulti multi_hash;
+
+  // XXH3 seeds, multiply-shift and CRC32C remix constants, `count` rows of
+  // `MULTIPLY_SHIFT_WORDS` for multiply-shift.
+  uint64_t *seeds;
+  // `count` * FT_SIZE tables of 256 entries.
+  uint32_t *tables;
+
+public:
+  PacketHasher();
+  ~PacketHasher();
+
+  // `bob_seeds` are BobHash prime indexes (below 1229), the other families
+  // derive their random state from them.
+  void initialize(HashFamily family, const uint32_t *bob_seeds, int count);
+  // Writes the first `count` hashes of `str` (FT_SIZE bytes) to `out`.
+  void run(const char *str, uint *out, int count);
+
+  HashFamily get_family() { return family; }
+};
@@ -0,0 +1,62 @@
+#include "heavy_hitters.hpp"
+
+#include <stdexcept>
+#include <string.h>
+
+#include "skew_estimation.hpp"
+#include "stream_summary.hpp"
+#include "topK.hpp"
+
+uint32_t HeavyHitters::key_hash(const char *packet) {
+  static_assert(FT_SIZE == 13, "key_hash assumes 13 byte packets");
+  uint64_t low;
+  uint64_t high = 0;
+  memcpy(&low, packet, 8);
+  memcpy(&high, packet + 8, 5);
+
+  uint64_t hash =
+      (low ^ (high * 0x9E3779B97F4A7C15ULL)) * 0xC2B2AE3D27D4EB4FULL;
+  return (uint32_t)(hash >> 32);
+}
+
+HeavyHitters::~HeavyHitters() { delete skew_tracker; }
+
+double HeavyHitters::tracked_skew() {
+  if (skew_tracker == nullptr) {
+    skew_tracker = new IncrementalSkewEstimator();
+    for (const TopKItem &item : descending()) {
+      skew_tracker->insert(item.second);
+    }
+  }
+  return skew_tracker->skew();
+}
+
+std::string heavy_hitter_mode_name(HeavyHitterMode mode) {
+  switch (mode) {
+  case top_k_heap:
+    return "heap";
+  case stream_summary:
+    return "stream_summary";
+  }
+  throw std::runtime_error("invalid heavy hitter mode");
+}
+
+HeavyHitterMode parse_heavy_hitter_mode(const char *name) {
+  for (int i = 0; i < HEAVY_HITTER_MODE_COUNT; i++) {
+    if (heavy_hitter_mode_name((HeavyHitterMode)i) == name) {
+      return (HeavyHitterMode)i;
+    }
+  }
+  throw std::runtime_error(std::string("Unknown heavy hitter structure ") +
+                           name);
+}
+
+HeavyHitters *make_heavy_hitters(HeavyHitterMode mode, int k) {
+  switch (mode) {
+  case top_k_heap:
+    return new TopK(k);
+  case stream_summary:
+    return new StreamSummary(k);
+  }
+  throw std::runtime_error("invalid heavy hitter mode");
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Defs.hpp"
+#include <array>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef pair<std::array<char, FT_SIZE>, uint32_t> TopKItem;
+typedef vector<TopKItem>::const_iterator TopKIterator;
+
+/// The items of a TopK from the largest down, valid until its next update.
+class TopKView {
+  TopKIterator first;
+  TopKIterator last;
+
+public:
+  TopKView(TopKIterator first, TopKIterator last) : first(first), last(last) {}
+
+  TopKIterator begin() const { return first; }
+  TopKIterator end() const { return last; }
+  size_t size() const { return last - first; }
+};
+
+class IncrementalSkewEstimator;
+
+/// Tracks the (at most) k most frequent packets of a stream, the sketches use
+/// it to estimate the skew.
+class HeavyHitters {
+protected:
+  // Told about every change to the items once `tracked_skew` was called.
+  IncrementalSkewEstimator *skew_tracker;
+
+  static uint32_t key_hash(const char *packet);
+
+public:
+  HeavyHitters() : skew_tracker(nullptr) {}
+  HeavyHitters(const HeavyHitters &) = delete;
+  HeavyHitters &operator=(const HeavyHitters &) = delete;
+  virtual ~HeavyHitters();
+
+  // Called once per packet, `value` is the packet's estimated count so far.
+  virtual void update(const char *packet, uint32_t value) = 0;
+
+  // A copy of the items in ascending (value, key) order.
+  virtual vector<TopKItem> items() = 0;
+  // The items in descending value order without copying them out.
+  virtual TopKView descending() = 0;
+
+  // `regression_estimate_skew` of the items. The first call starts
+  // maintaining it as the items change, after which it is O(1).
+  double tracked_skew();
+};
+
+/// The heavy hitter structures, selected for the final experiments with
+/// `--heavy_hitters=<name>`.
+enum HeavyHitterMode {
+  // `TopK`, keeps the k packets with the largest value they were updated with.
+  top_k_heap = 0,
+  // `StreamSummary`, Space-Saving over the packets themselves.
+  stream_summary = 1,
+};
+
+const int HEAVY_HITTER_MODE_COUNT = 2;
+
+std::string heavy_hitter_mode_name(HeavyHitterMode mode);
+// Parses the short names accepted on the command line (heap, stream_summary).
+HeavyHitterMode parse_heavy_hitter_mode(const char *name);
+
+HeavyHitters *make_heavy_hitters(HeavyHitterMode mode, int k);
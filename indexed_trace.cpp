@@ -0,0 +1,247 @@
+#include "indexed_trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <assert.h>
+#include <climits>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <unordered_set>
+
+#include "ArrayHasher.hpp"
+#include "xxhash.h"
+
+TraceIndex::TraceIndex(const char *path) {
+  this->path = path;
+
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    std::string msg = "Failed to open indexed trace for reading --";
+    msg += path;
+    msg += "--";
+    throw std::runtime_error(msg);
+  }
+
+  IndexedTraceHeader header;
+  bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+            memcmp(header.magic, INDEXED_TRACE_MAGIC, 4) == 0;
+  if (!ok) {
+    fclose(f);
+    throw std::runtime_error(std::string("Not an indexed trace: ") + path);
+  }
+  if (header.version != INDEXED_TRACE_VERSION) {
+    fclose(f);
+    throw std::runtime_error("Unsupported indexed trace version " +
+                             std::to_string(header.version));
+  }
+
+  ok = fseeko(f, header.footer_offset, SEEK_SET) == 0 &&
+       fread(&footer, sizeof(footer), 1, f) == 1;
+  if (ok) {
+    chunks.resize(footer.chunk_count);
+    ok = fread(chunks.data(), sizeof(IndexedTraceChunk), chunks.size(), f) ==
+         chunks.size();
+  }
+  fclose(f);
+  if (!ok) {
+    throw std::runtime_error(std::string("Truncated indexed trace: ") + path);
+  }
+
+  uint64_t packets = 0;
+  for (const IndexedTraceChunk &chunk : chunks) {
+    if (chunk.packets > footer.chunk_packets ||
+        chunk.offset + chunk.packets * FT_SIZE > header.footer_offset) {
+      throw std::runtime_error(std::string("Corrupt indexed trace: ") + path);
+    }
+    packets += chunk.packets;
+  }
+  if (packets != footer.packet_count) {
+    throw std::runtime_error(std::string("Corrupt indexed trace: ") + path);
+  }
+}
+
+void TraceIndex::slice_chunks(int slice, int slices, size_t *first,
+                              size_t *last) const {
+  assert(0 <= slice && slice < slices && "TraceIndex: invalid slice!");
+  *first = chunks.size() * slice / slices;
+  *last = chunks.size() * (slice + 1) / slices;
+}
+
+IndexedTraceReader::IndexedTraceReader(const TraceIndex &index) {
+  open_trace(index, 0, index.chunks.size());
+}
+
+IndexedTraceReader::IndexedTraceReader(const TraceIndex &index,
+                                       size_t first_chunk, size_t last_chunk) {
+  open_trace(index, first_chunk, last_chunk);
+}
+
+void IndexedTraceReader::open_trace(const TraceIndex &index,
+                                    size_t first_chunk, size_t last_chunk) {
+  assert(first_chunk <= last_chunk && last_chunk <= index.chunks.size() &&
+         "IndexedTraceReader: invalid chunks!");
+
+  fd = open(index.path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::string msg = "Failed to open indexed trace for reading --";
+    msg += index.path;
+    msg += "--";
+    throw std::runtime_error(msg);
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  chunks.assign(index.chunks.begin() + first_chunk,
+                index.chunks.begin() + last_chunk);
+  next_chunk = 0;
+  position = 0;
+}
+
+IndexedTraceReader::~IndexedTraceReader() { close(fd); }
+
+bool IndexedTraceReader::load_chunk() {
+  if (next_chunk == chunks.size()) {
+    return false;
+  }
+  const IndexedTraceChunk &chunk = chunks[next_chunk++];
+
+  buffer.resize(chunk.packets * FT_SIZE);
+  size_t size = 0;
+  while (size < buffer.size()) {
+    ssize_t n = pread(fd, buffer.data() + size, buffer.size() - size,
+                      chunk.offset + size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw std::runtime_error("Failed to read indexed trace chunk");
+    }
+    size += n;
+  }
+
+  if (XXH64(buffer.data(), buffer.size(), 0) != chunk.checksum) {
+    throw std::runtime_error("Indexed trace chunk at offset " +
+                             std::to_string(chunk.offset) +
+                             " does not match its checksum");
+  }
+  position = 0;
+  return true;
+}
+
+size_t IndexedTraceReader::read_packets(char *dest, size_t max) {
+  size_t n = 0;
+  while (n < max) {
+    if (position == buffer.size() && !load_chunk()) {
+      break;
+    }
+    size_t count = std::min(max - n, (buffer.size() - position) / FT_SIZE);
+    memcpy(dest + n * FT_SIZE, buffer.data() + position, count * FT_SIZE);
+    position += count * FT_SIZE;
+    n += count;
+  }
+  return n;
+}
+
+int IndexedTraceReader::read_next_packet(char *dest) {
+  return read_packets(dest, 1) * FT_SIZE;
+}
+
+uint64_t convert_to_indexed_trace(char *raw_path, const char *indexed_path,
+                                  uint32_t chunk_packets) {
+  if (chunk_packets == 0) {
+    throw std::runtime_error("Indexed trace chunks need at least one packet");
+  }
+
+  FILE *out = fopen(indexed_path, "wb");
+  if (out == NULL) {
+    throw std::runtime_error(std::string("Failed to open ") + indexed_path);
+  }
+
+  IndexedTraceHeader header;
+  memcpy(header.magic, INDEXED_TRACE_MAGIC, 4);
+  header.version = INDEXED_TRACE_VERSION;
+  header.footer_offset = 0;
+  // Rewritten with the footer offset at the end.
+  fwrite(&header, sizeof(header), 1, out);
+
+  IndexedTraceFooter footer;
+  footer.packet_count = 0;
+  footer.chunk_packets = chunk_packets;
+  std::vector<IndexedTraceChunk> chunks;
+
+  std::unordered_set<std::array<char, FT_SIZE>, ArrayHasher> keys;
+  int64_t largest_id = -1;
+  bool negative_id = false;
+
+  std::vector<char> chunk;
+  chunk.reserve((size_t)chunk_packets * FT_SIZE);
+  uint64_t offset = sizeof(header);
+
+  auto flush_chunk = [&]() {
+    IndexedTraceChunk entry;
+    entry.offset = offset;
+    entry.packets = chunk.size() / FT_SIZE;
+    entry.checksum = XXH64(chunk.data(), chunk.size(), 0);
+    chunks.push_back(entry);
+
+    fwrite(chunk.data(), 1, chunk.size(), out);
+    offset += chunk.size();
+    chunk.clear();
+  };
+
+  ZipfReader *reader = new ZipfReader(raw_path);
+  for (char *packet : TracePackets(reader)) {
+    std::array<char, FT_SIZE> key;
+    memcpy(key.data(), packet, FT_SIZE);
+    keys.insert(key);
+
+    int id;
+    memcpy(&id, packet, sizeof(id));
+    negative_id |= id < 0;
+    largest_id = std::max(largest_id, (int64_t)id);
+
+    chunk.insert(chunk.end(), packet, packet + FT_SIZE);
+    footer.packet_count++;
+    if (chunk.size() == (size_t)chunk_packets * FT_SIZE) {
+      flush_chunk();
+    }
+  }
+  delete reader;
+  if (!chunk.empty()) {
+    flush_chunk();
+  }
+
+  footer.distinct_keys = keys.size();
+  footer.key_domain = negative_id ? 0 : largest_id + 1;
+  footer.chunk_count = chunks.size();
+  header.footer_offset = offset;
+
+  fwrite(&footer, sizeof(footer), 1, out);
+  fwrite(chunks.data(), sizeof(IndexedTraceChunk), chunks.size(), out);
+  fseeko(out, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, out);
+  if (ferror(out) || fclose(out) != 0) {
+    throw std::runtime_error(std::string("Failed to write ") + indexed_path);
+  }
+  return footer.packet_count;
+}
+
+int trace_key_domain(const char *path) {
+  if (!trace_has_magic(path, INDEXED_TRACE_MAGIC)) {
+    return 0;
+  }
+  uint64_t domain = TraceIndex(path).footer.key_domain;
+  return domain <= INT_MAX ? (int)domain : 0;
+}
+
+uint64_t trace_distinct_keys(const char *path) {
+  if (!trace_has_magic(path, INDEXED_TRACE_MAGIC)) {
+    return 0;
+  }
+  return TraceIndex(path).footer.distinct_keys;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "TraceReader.hpp"
+
+/// A trace whose packets are split into chunks listed in a footer, so that
+/// readers can start at any chunk, threads can each take a slice of the
+/// trace, and the packet count is known without reading it.
+///
+/// The file is an `IndexedTraceHeader`, the packets as raw FT_SIZE byte
+/// records, then an `IndexedTraceFooter` followed by one `IndexedTraceChunk`
+/// per chunk. All integers are little endian. Like compact traces there is no
+/// leading record to skip: the trace holds exactly the packets ZipfReader
+/// yields for the raw trace it was made from.
+struct IndexedTraceHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t footer_offset;
+};
+
+struct IndexedTraceFooter {
+  uint64_t packet_count;
+  uint64_t distinct_keys;
+  // One more than the largest id of the packets (their first 4 bytes as an
+  // int, as PacketCounter indexes them), 0 if an id is negative.
+  uint64_t key_domain;
+  uint32_t chunk_packets;
+  uint32_t chunk_count;
+};
+
+struct IndexedTraceChunk {
+  uint64_t offset;
+  uint64_t packets;
+  // XXH64 (seed 0) of the chunk's records.
+  uint64_t checksum;
+};
+
+static_assert(sizeof(IndexedTraceHeader) == 16 &&
+                  sizeof(IndexedTraceFooter) == 32 &&
+                  sizeof(IndexedTraceChunk) == 24,
+              "the indexed trace structs are written as is");
+
+const char INDEXED_TRACE_MAGIC[4] = {'I', 'T', 'R', 'C'};
+const uint32_t INDEXED_TRACE_VERSION = 1;
+
+/// The header and footer of an indexed trace.
+class TraceIndex {
+public:
+  std::string path;
+  IndexedTraceFooter footer;
+  std::vector<IndexedTraceChunk> chunks;
+
+  // Throws if `path` is not an indexed trace.
+  TraceIndex(const char *path);
+
+  uint64_t packet_count() const { return footer.packet_count; }
+
+  // The chunks [`*first`, `*last`) of the `slice`-th of `slices` runs of
+  // (nearly) the same number of chunks.
+  void slice_chunks(int slice, int slices, size_t *first, size_t *last) const;
+};
+
+/// Reads a run of the chunks of an indexed trace, checking each chunk's
+/// checksum as it is read.
+class IndexedTraceReader : public PacketReader {
+public:
+  // All the chunks.
+  IndexedTraceReader(const TraceIndex &index);
+  // The chunks [first_chunk, last_chunk).
+  IndexedTraceReader(const TraceIndex &index, size_t first_chunk,
+                     size_t last_chunk);
+  ~IndexedTraceReader();
+
+  int read_next_packet(char *dest);
+  size_t read_packets(char *dest, size_t max);
+
+private:
+  int fd;
+  std::vector<IndexedTraceChunk> chunks;
+  size_t next_chunk;
+
+  // The records of the current chunk.
+  std::vector<char> buffer;
+  size_t position;
+
+  void open_trace(const TraceIndex &index, size_t first_chunk,
+                  size_t last_chunk);
+  // Reads and checks the next chunk, returns false after the last one.
+  bool load_chunk();
+};
+
+// Converts the raw trace at `raw_path` to an indexed trace, returns the number
+// of packets. Throws (before writing anything) if `chunk_packets` is 0.
+uint64_t convert_to_indexed_trace(char *raw_path, const char *indexed_path,
+                                  uint32_t chunk_packets = 1 << 20);
+
+// The `key_domain` of an indexed trace, 0 for other traces (or when it does
+// not fit an int).
+int trace_key_domain(const char *path);
+// The `distinct_keys` of an indexed trace, 0 for other traces.
+uint64_t trace_distinct_keys(const char *path);
@@ -1,5 +1,8 @@
 #include "CMS.hpp"
 #include "TraceReader.hpp"
+#include "compact_trace.hpp"
+#include "indexed_trace.hpp"
+#include "pcap_converter.hpp"
 #include "genzipf.h"
 #include <iostream>
 #include <stdio.h>
@@ -7,8 +10,54 @@
 
 #include "experiment.hpp"
 #include "final_experiments.hpp"
+#include "performance_experiments.hpp"
+
+// Removes the `--key=value` flags from `argv` (so the positional arguments of
+// the experiments are unchanged) and returns the options they select.
+static ExperimentOptions parse_experiment_options(int *argc, char **argv) {
+  ExperimentOptions options;
+  int positional = 0;
+
+  for (int i = 0; i < *argc; i++) {
+    if (strncmp(argv[i], "--", 2) != 0) {
+      argv[positional++] = argv[i];
+      continue;
+    }
+
+    char *value = strchr(argv[i], '=');
+    if (value == NULL) {
+      throw std::runtime_error(std::string("Expected --key=value, got ") +
+                               argv[i]);
+    }
+    std::string key(argv[i] + 2, value - argv[i] - 2);
+    value++;
+
+    if (key == "hash") {
+      options.hash_family = parse_hash_family(value);
+    } else if (key == "conservative_results") {
+      options.conservative_results_path = value;
+    } else if (key == "conservative_dynamic") {
+      options.conservative_dynamic = stoi(value) != 0;
+    } else if (key == "heavy_hitters") {
+      options.heavy_hitters = parse_heavy_hitter_mode(value);
+    } else if (key == "skew_estimator") {
+      options.skew_estimator = parse_skew_estimator(value);
+    } else if (key == "async_reconfigure") {
+      options.async_reconfigure = stoi(value) != 0;
+    } else if (key == "trace_reader") {
+      options.trace_reader = parse_trace_reader_mode(value);
+    } else {
+      throw std::runtime_error("Unknown option --" + key);
+    }
+  }
+
+  *argc = positional;
+  return options;
+}
 
 int main(int argc, char **argv) {
+  ExperimentOptions options = parse_experiment_options(&argc, argv);
+
   if (argc < 2) {
     printf("Missing arguments to program\n");
     return -1;
@@ -133,8 +182,15 @@ int main(int argc, char **argv) {
     FILE *traditional_results = fopen(traditional_output, "w");
     FILE *skew_estimation = fopen(skew_estimation_output, "w");
 
+    // The blocked sketch is optional so that existing scripts keep working.
+    FILE *blocked_results = NULL;
+    if (argc >= 8) {
+      blocked_results = fopen(argv[7], "w");
+    }
+
     baseline_performance_fixed_mem_synthetic(
-        mem, trace, flat_results, traditional_results, skew_estimation);
+        mem, trace, flat_results, traditional_results, blocked_results,
+        skew_estimation, options);
   } else if (strcmp("final_baseline_performance_fixed_mem_real_world",
                     argv[1]) == 0) {
     if (argc < 7) {
@@ -152,8 +208,15 @@ int main(int argc, char **argv) {
     FILE *traditional_results = fopen(traditional_output, "w");
     FILE *skew_estimation = fopen(skew_estimation_output, "w");
 
+    // The blocked sketch is optional so that existing scripts keep working.
+    FILE *blocked_results = NULL;
+    if (argc >= 8) {
+      blocked_results = fopen(argv[7], "w");
+    }
+
     baseline_performance_fixed_mem_real_world(
-        mem, trace, flat_results, traditional_results, skew_estimation);
+        mem, trace, flat_results, traditional_results, blocked_results,
+        skew_estimation, options);
   } else if (strcmp("final_dynamic_performance_fixed_mem_synthetic", argv[1]) ==
              0) {
     if (argc < 6) {
@@ -170,7 +233,7 @@ int main(int argc, char **argv) {
     FILE *skew_estimation = fopen(skew_estimation_output, "w");
 
     dynamic_performance_fixed_mem_synthetic(mem, trace, dynamic_results,
-                                            skew_estimation);
+                                            skew_estimation, options);
   } else if (strcmp("final_dynamic_performance_fixed_mem_real_world",
                     argv[1]) == 0) {
     if (argc < 6) {
@@ -187,7 +250,165 @@ int main(int argc, char **argv) {
     FILE *skew_estimation = fopen(skew_estimation_output, "w");
 
     dynamic_performance_fixed_mem_real_world(mem, trace, dynamic_results,
-                                             skew_estimation);
+                                             skew_estimation, options);
+  } else if (strcmp("index_mode_performance", argv[1]) == 0) {
+    if (argc < 5) {
+      printf("Missing arguments to experiment\n");
+      return -1;
+    }
+
+    char *trace = argv[2];
+    char *output = argv[3];
+    int mem = stoi(argv[4]);
+
+    FILE *results = fopen(output, "w");
+
+    index_mode_performance(mem, trace, results);
+  } else if (strcmp("conservative_performance", argv[1]) == 0) {
+    if (argc < 5) {
+      printf("Missing arguments to experiment\n");
+      return -1;
+    }
+
+    char *trace = argv[2];
+    char *output = argv[3];
+    int mem = stoi(argv[4]);
+
+    FILE *results = fopen(output, "w");
+
+    conservative_performance(mem, trace, results);
+  } else if (strcmp("batch_performance", argv[1]) == 0) {
+    if (argc < 4) {
+      printf("Missing arguments to experiment\n");
+      return -1;
+    }
+
+    char *trace = argv[2];
+    char *output = argv[3];
+
+    FILE *results = fopen(output, "w");
+
+    batch_performance(trace, results);
+  } else if (strcmp("page_mode_performance", argv[1]) == 0) {
+    if (argc < 4) {
+      printf("Missing arguments to experiment\n");
+      return -1;
+    }
+
+    char *trace = argv[2];
+    char *output = argv[3];
+
+    FILE *results = fopen(output, "w");
+
+    page_mode_performance(trace, results);
+  } else if (strcmp("template_performance", argv[1]) == 0) {
+    if (argc < 5) {
+      printf("Missing arguments to experiment\n");
+      return -1;
+    }
+
+    char *trace = argv[2];
+    char *output = argv[3];
+    int mem = stoi(argv[4]);
+
+    FILE *results = fopen(output, "w");
+
+    template_performance(mem, trace, results);
+  } else if (strcmp("hash_family_performance", argv[1]) == 0) {
+    if (argc < 5) {
+      printf("Missing arguments to experiment\n");
+      return -1;
+    }
+
+    char *trace = argv[2];
+    char *output = argv[3];
+    int mem = stoi(argv[4]);
+
+    FILE *results = fopen(output, "w");
+
+    hash_family_performance(mem, trace, results);
+  } else if (strcmp("topk_performance", argv[1]) == 0) {
+    if (argc < 4) {
+      printf("Missing arguments to experiment\n");
+      return -1;
+    }
+
+    char *trace = argv[2];
+    char *output = argv[3];
+
+    FILE *results = fopen(output, "w");
+
+    topk_performance(trace, results);
+  } else if (strcmp("skew_estimator_performance", argv[1]) == 0) {
+    if (argc < 5) {
+      printf("Missing arguments to experiment\n");
+      return -1;
+    }
+
+    char *trace = argv[2];
+    double skew = stod(argv[3]);
+    char *output = argv[4];
+
+    FILE *results = fopen(output, "w");
+
+    skew_estimator_performance(trace, skew, results);
+  } else if (strcmp("trace_read_performance", argv[1]) == 0) {
+    if (argc < 4) {
+      printf("Missing arguments to experiment\n");
+      return -1;
+    }
+
+    char *trace = argv[2];
+    char *output = argv[3];
+    char *converted = argc > 4 ? argv[4] : NULL;
+
+    FILE *results = fopen(output, "w");
+
+    trace_read_performance(trace, converted, results);
+  } else if (strcmp("index_trace", argv[1]) == 0) {
+    if (argc < 4) {
+      printf("Missing arguments for index_trace [raw trace] [output] "
+             "[packets per chunk]\n");
+      return -1;
+    }
+
+    char *trace = argv[2];
+    char *output = argv[3];
+    int chunk_packets = argc > 4 ? stoi(argv[4]) : 1 << 20;
+    if (chunk_packets <= 0) {
+      printf("The packets per chunk must be positive\n");
+      return -1;
+    }
+
+    uint64_t packets = convert_to_indexed_trace(trace, output, chunk_packets);
+    printf("wrote %lu packets to %s\n", (unsigned long)packets, output);
+  } else if (strcmp("convert_pcap", argv[1]) == 0) {
+    if (argc < 4) {
+      printf("Missing arguments for convert_pcap [pcap] [output] "
+             "[threads]\n");
+      return -1;
+    }
+
+    char *pcap = argv[2];
+    char *output = argv[3];
+    int threads = argc > 4 ? stoi(argv[4]) : 0;
+
+    PcapConversion conversion = convert_pcap(pcap, output, threads);
+    printf("converted %lu of %lu packets in %f seconds (%E packets per "
+           "second)\n",
+           (unsigned long)conversion.records, (unsigned long)conversion.packets,
+           conversion.seconds, conversion.packets / conversion.seconds);
+  } else if (strcmp("compact_trace", argv[1]) == 0) {
+    if (argc < 4) {
+      printf("Missing arguments for compact_trace [raw trace] [output]\n");
+      return -1;
+    }
+
+    char *trace = argv[2];
+    char *output = argv[3];
+
+    uint64_t packets = convert_to_compact_trace(trace, output);
+    printf("wrote %lu packets to %s\n", (unsigned long)packets, output);
   } else {
     printf("Unrecognised command %s\n", argv[1]);
     return -1;
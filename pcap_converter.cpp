@@ -0,0 +1,362 @@
+#include "pcap_converter.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "Defs.hpp"
+
+static_assert(FT_SIZE == 13, "the pcap records are 13 bytes");
+
+// Link types, see https://www.tcpdump.org/linktypes.html
+const uint32_t LINKTYPE_NULL = 0;
+const uint32_t LINKTYPE_ETHERNET = 1;
+const uint32_t LINKTYPE_RAW = 101;
+const uint32_t LINKTYPE_LINUX_SLL = 113;
+const uint32_t LINKTYPE_IPV4 = 228;
+const uint32_t LINKTYPE_LINUX_SLL2 = 276;
+
+const uint32_t PCAPNG_SECTION_HEADER = 0x0A0D0D0A;
+const uint32_t PCAPNG_INTERFACE_DESCRIPTION = 1;
+const uint32_t PCAPNG_SIMPLE_PACKET = 3;
+const uint32_t PCAPNG_ENHANCED_PACKET = 6;
+
+struct CapturedPacket {
+  const uint8_t *data;
+  uint32_t length;
+  uint32_t link_type;
+};
+
+static uint16_t big_endian16(const uint8_t *p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/// Walks the packets of a pcap or pcapng capture in order.
+class CaptureScanner {
+  const uint8_t *next;
+  const uint8_t *end;
+  bool pcapng;
+  // Whether the capture (or the current pcapng section) was written with the
+  // other byte order.
+  bool swapped;
+  // The link type of a pcap, or of each interface of a pcapng section.
+  uint32_t link_type;
+  std::vector<uint32_t> interfaces;
+
+  uint16_t read16(const uint8_t *p) {
+    uint16_t value;
+    memcpy(&value, p, 2);
+    return swapped ? __builtin_bswap16(value) : value;
+  }
+  uint32_t read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return swapped ? __builtin_bswap32(value) : value;
+  }
+
+  bool next_pcap_packet(CapturedPacket *packet);
+  bool next_pcapng_packet(CapturedPacket *packet);
+
+public:
+  // Set when the capture ends part way through a record.
+  bool truncated;
+
+  CaptureScanner(const uint8_t *data, size_t size);
+
+  bool next_packet(CapturedPacket *packet) {
+    return pcapng ? next_pcapng_packet(packet) : next_pcap_packet(packet);
+  }
+};
+
+CaptureScanner::CaptureScanner(const uint8_t *data, size_t size) {
+  this->next = data;
+  this->end = data + size;
+  this->swapped = false;
+  this->link_type = 0;
+  this->truncated = false;
+
+  uint32_t magic = 0;
+  if (size >= 4) {
+    memcpy(&magic, data, 4);
+  }
+
+  if (magic == PCAPNG_SECTION_HEADER) {
+    // Sections are read (and their byte order found) as blocks.
+    pcapng = true;
+    return;
+  }
+
+  pcapng = false;
+  if (magic == 0xA1B2C3D4 || magic == 0xA1B23C4D) {
+    swapped = false;
+  } else if (magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1) {
+    swapped = true;
+  } else {
+    throw std::runtime_error("Not a pcap or pcapng capture");
+  }
+  if (size < 24) {
+    throw std::runtime_error("Truncated pcap header");
+  }
+  // The upper bits hold the FCS length.
+  link_type = read32(data + 20) & 0xFFFF;
+  next = data + 24;
+}
+
+bool CaptureScanner::next_pcap_packet(CapturedPacket *packet) {
+  if (end - next < 16) {
+    truncated = next != end;
+    return false;
+  }
+  uint32_t captured = read32(next + 8);
+  if ((size_t)(end - next - 16) < captured) {
+    truncated = true;
+    return false;
+  }
+
+  packet->data = next + 16;
+  packet->length = captured;
+  packet->link_type = link_type;
+  next += 16 + captured;
+  return true;
+}
+
+bool CaptureScanner::next_pcapng_packet(CapturedPacket *packet) {
+  while (end - next >= 12) {
+    uint32_t type;
+    memcpy(&type, next, 4);
+    if (type == PCAPNG_SECTION_HEADER) {
+      uint32_t byte_order;
+      memcpy(&byte_order, next + 8, 4);
+      if (byte_order == 0x1A2B3C4D) {
+        swapped = false;
+      } else if (byte_order == 0x4D3C2B1A) {
+        swapped = true;
+      } else {
+        throw std::runtime_error("Corrupt pcapng section header");
+      }
+      interfaces.clear();
+    } else {
+      type = read32(next);
+    }
+
+    uint32_t total = read32(next + 4);
+    if (total < 12 || total % 4 != 0 || (size_t)(end - next) < total) {
+      truncated = true;
+      return false;
+    }
+    const uint8_t *body = next + 8;
+    uint32_t body_length = total - 12;
+    next += total;
+
+    if (type == PCAPNG_INTERFACE_DESCRIPTION && body_length >= 8) {
+      interfaces.push_back(read16(body));
+    } else if (type == PCAPNG_ENHANCED_PACKET && body_length >= 20) {
+      uint32_t interface = read32(body);
+      uint32_t captured = read32(body + 12);
+      if (interface < interfaces.size() && captured <= body_length - 20) {
+        packet->data = body + 20;
+        packet->length = captured;
+        packet->link_type = interfaces[interface];
+        return true;
+      }
+    } else if (type == PCAPNG_SIMPLE_PACKET && body_length >= 4 &&
+               !interfaces.empty()) {
+      packet->data = body + 4;
+      packet->length = std::min(read32(body), body_length - 4);
+      packet->link_type = interfaces[0];
+      return true;
+    }
+  }
+
+  truncated = next != end;
+  return false;
+}
+
+// Writes the record of an IPv4 TCP or UDP packet to `record`, returns false
+// for any other packet.
+static bool parse_packet(const CapturedPacket &packet, char *record) {
+  const uint8_t *data = packet.data;
+  uint32_t length = packet.length;
+  uint32_t offset;
+
+  switch (packet.link_type) {
+  case LINKTYPE_ETHERNET: {
+    if (length < 14) {
+      return false;
+    }
+    uint16_t ether_type = big_endian16(data + 12);
+    offset = 14;
+    // 802.1Q and 802.1ad tags.
+    while (ether_type == 0x8100 || ether_type == 0x88A8) {
+      if (length < offset + 4) {
+        return false;
+      }
+      ether_type = big_endian16(data + offset + 2);
+      offset += 4;
+    }
+    if (ether_type != 0x0800) {
+      return false;
+    }
+    break;
+  }
+  case LINKTYPE_NULL: {
+    // The address family in the byte order of the capturing host.
+    if (length < 4 || !((data[0] == 2 && data[3] == 0) ||
+                        (data[0] == 0 && data[3] == 2))) {
+      return false;
+    }
+    offset = 4;
+    break;
+  }
+  case LINKTYPE_RAW:
+  case LINKTYPE_IPV4:
+    offset = 0;
+    break;
+  case LINKTYPE_LINUX_SLL:
+    if (length < 16 || big_endian16(data + 14) != 0x0800) {
+      return false;
+    }
+    offset = 16;
+    break;
+  case LINKTYPE_LINUX_SLL2:
+    if (length < 20 || big_endian16(data) != 0x0800) {
+      return false;
+    }
+    offset = 20;
+    break;
+  default:
+    return false;
+  }
+
+  if (length < offset + 20) {
+    return false;
+  }
+  const uint8_t *ip = data + offset;
+  uint32_t header_length = (ip[0] & 0x0F) * 4;
+  if ((ip[0] >> 4) != 4 || header_length < 20) {
+    return false;
+  }
+
+  uint8_t protocol = ip[9];
+  if (protocol != 6 && protocol != 17) {
+    return false;
+  }
+  // Only the first fragment carries the ports.
+  if ((big_endian16(ip + 6) & 0x1FFF) != 0) {
+    return false;
+  }
+  if (length < offset + header_length + 4) {
+    return false;
+  }
+  const uint8_t *ports = ip + header_length;
+
+  memcpy(record, ip + 12, 4);
+  memcpy(record + 4, ports, 2);
+  memcpy(record + 6, ip + 16, 4);
+  memcpy(record + 10, ports + 2, 2);
+  record[12] = protocol == 17 ? 0 : 1;
+  return true;
+}
+
+PcapConversion convert_pcap(const char *pcap_path, const char *trace_path,
+                            int threads) {
+  auto start = std::chrono::steady_clock::now();
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  int fd = open(pcap_path, O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error(std::string("Failed to open ") + pcap_path);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    throw std::runtime_error(std::string("Failed to stat ") + pcap_path);
+  }
+  size_t size = st.st_size;
+  void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    throw std::runtime_error(std::string("Failed to map ") + pcap_path);
+  }
+  madvise(mapping, size, MADV_SEQUENTIAL);
+
+  FILE *out = fopen(trace_path, "wb");
+  if (out == NULL) {
+    munmap(mapping, size);
+    throw std::runtime_error(std::string("Failed to open ") + trace_path);
+  }
+
+  CaptureScanner scanner((const uint8_t *)mapping, size);
+
+  const size_t window_packets = 1 << 20;
+  std::vector<CapturedPacket> window;
+  window.reserve(window_packets);
+  std::vector<std::vector<char>> slices(threads);
+
+  PcapConversion conversion = {0, 0, 0.0};
+  while (true) {
+    window.clear();
+    CapturedPacket packet;
+    while (window.size() < window_packets && scanner.next_packet(&packet)) {
+      window.push_back(packet);
+    }
+    if (window.empty()) {
+      break;
+    }
+
+    size_t slice_packets = (window.size() + threads - 1) / threads;
+    auto convert_slice = [&](int slice) {
+      std::vector<char> &records = slices[slice];
+      size_t first = std::min(window.size(), slice * slice_packets);
+      size_t last = std::min(window.size(), first + slice_packets);
+      records.resize((last - first) * FT_SIZE);
+      size_t n = 0;
+      for (size_t i = first; i < last; i++) {
+        if (parse_packet(window[i], records.data() + n * FT_SIZE)) {
+          n++;
+        }
+      }
+      records.resize(n * FT_SIZE);
+    };
+
+    std::vector<std::thread> workers;
+    for (int slice = 1; slice < threads; slice++) {
+      workers.emplace_back(convert_slice, slice);
+    }
+    convert_slice(0);
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+
+    for (const std::vector<char> &records : slices) {
+      fwrite(records.data(), 1, records.size(), out);
+      conversion.records += records.size() / FT_SIZE;
+    }
+    conversion.packets += window.size();
+  }
+
+  if (scanner.truncated) {
+    printf("warning: %s ends part way through a packet\n", pcap_path);
+  }
+
+  munmap(mapping, size);
+  if (ferror(out) || fclose(out) != 0) {
+    throw std::runtime_error(std::string("Failed to write ") + trace_path);
+  }
+
+  conversion.seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+  return conversion;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+/// Converts packet captures (pcap or pcapng) to the binary traces read by the
+/// real-world experiments, producing what the tcpdump pipeline the scripts
+/// used to run did: per IPv4 TCP or UDP packet a FT_SIZE byte record of the
+/// source address and port, the destination address and port (in network
+/// order) and the protocol (0 for UDP, 1 for TCP).
+///
+/// The capture is memory mapped. Its packets are found in windows on the
+/// calling thread, each window's headers are parsed by `threads` threads in
+/// contiguous slices, and the slices are written out in order, so the trace
+/// keeps the packet order of the capture.
+///
+/// Ethernet (with VLAN tags), raw IP, BSD loopback and Linux cooked captures
+/// are supported. Other packets (IPv6, ARP, non-first fragments, other
+/// protocols, or ones truncated before the ports) are skipped.
+struct PcapConversion {
+  // Packets in the capture, and records written for them.
+  uint64_t packets;
+  uint64_t records;
+  double seconds;
+};
+
+// `threads` <= 0 uses one per hardware thread.
+PcapConversion convert_pcap(const char *pcap_path, const char *trace_path,
+                            int threads = 0);
@@ -0,0 +1,829 @@
+#include "performance_experiments.hpp"
+
+#include <chrono>
+#include <thread>
+
+#include "compact_trace.hpp"
+#include "count_min.hpp"
+#include "indexed_trace.hpp"
+#include "prefetching_reader.hpp"
+#include "topK.hpp"
+
+// Reads (up to `max_packets` of) a trace into memory so that reading the trace
+// is not part of the timed loops.
+static vector<char> load_trace(char *trace_path, long max_packets) {
+  MappedTraceReader reader(trace_path);
+  size_t n = std::min((size_t)max_packets, reader.packet_count());
+  return vector<char>(reader.packets(), reader.packets() + n * FT_SIZE);
+}
+
+// Fills `actual` with the true count of every packet at the time it is seen
+// (what the final experiments compare the estimates against) and `trueTopK`
+// with the most frequent packets.
+static void count_packets(vector<char> &packets, vector<int> &actual,
+                          HeavyHitters &trueTopK) {
+  long total = packets.size() / FT_SIZE;
+  HashPacketCounter *counter = new HashPacketCounter(1 << 28);
+  actual.reserve(total);
+
+  for (long i = 0; i < total; i++) {
+    char *packet = packets.data() + i * FT_SIZE;
+    int count = counter->increment(packet);
+    trueTopK.update(packet, count);
+    actual.push_back(count);
+  }
+  delete counter;
+}
+
+// Feeds every packet through `variant` (increment and query, exactly like the
+// final experiments do) and returns the throughput in packets per second.
+static double timed_evaluation(SketchEvaluation *variant,
+                               const vector<char> &packets,
+                               const vector<int> &actual) {
+  long total = actual.size();
+  char *packet = (char *)packets.data();
+
+  auto start = chrono::steady_clock::now();
+  for (long i = 0; i < total; i++) {
+    variant->handle_packet(packet + i * FT_SIZE, actual[i], i + 1);
+  }
+  auto end = chrono::steady_clock::now();
+
+  double seconds = chrono::duration<double>(end - start).count();
+  return (double)total / seconds;
+}
+
+// Compares per row BobHash indexing against double hashing on both throughput
+// and the normalized / heavy hitter error of the flat and dynamic sketches.
+void index_mode_performance(int mem, char *trace_path, FILE *results) {
+  const int k = 100;
+  const long max_packets = 1 << 25;
+
+  vector<char> packets = load_trace(trace_path, max_packets);
+  long total = packets.size() / FT_SIZE;
+
+  TopK trueTopK(2000);
+  vector<int> actual;
+  count_packets(packets, actual, trueTopK);
+
+  // set phi=0.1%
+  int heavy_hitter_threshold = (int)(0.001 * (double)total);
+
+  fprintf(results, "index mode,variant,hash functions,packets per "
+                   "second,normalized error,heavy hitter error\n");
+
+  for (int m = 0; m <= 1; m++) {
+    IndexMode mode = (IndexMode)m;
+
+    for (int i = 1; i < 10; i++) {
+      CountMinFlat *flat = new CountMinFlat(k);
+      flat->initialize(mem, i, 10, mode);
+      SketchEvaluation *variant = new SketchEvaluation(flat, Flat);
+
+      double throughput = timed_evaluation(variant, packets, actual);
+      double normalized_error = variant->normalized_error(total);
+      double heavy_hitter_err = variant->heavy_hitter_err_real_world(
+          trueTopK, heavy_hitter_threshold, total);
+
+      fprintf(results, "%s,flat,%d,%E,%E,%E\n", index_mode_name(mode).c_str(),
+              i, throughput, normalized_error, heavy_hitter_err);
+
+      delete variant;
+      delete flat;
+    }
+
+    DynamicCountMin *dynamic = new DynamicCountMin(k, normalized, true);
+    dynamic->initialize(mem, 4, 10, mode);
+    SketchEvaluation *variant = new SketchEvaluation(dynamic, Flat);
+
+    double throughput = timed_evaluation(variant, packets, actual);
+    double normalized_error = variant->normalized_error(total);
+    double heavy_hitter_err = variant->heavy_hitter_err_real_world(
+        trueTopK, heavy_hitter_threshold, total);
+
+    fprintf(results, "%s,dynamic,%d,%E,%E,%E\n", index_mode_name(mode).c_str(),
+            dynamic->get_hash_function_count(), throughput, normalized_error,
+            heavy_hitter_err);
+
+    delete variant;
+    delete dynamic;
+  }
+
+  fclose(results);
+}
+
+// Times `sketch` incrementing every packet one at a time and in one batch
+// (each on a freshly initialized sketch) and checks that both end up with the
+// same counters.
+template <class Sketch>
+static void compare_batch(FILE *results, const char *name, int counters,
+                          int hash_functions, Sketch *single, Sketch *batch,
+                          const vector<char> &packets) {
+  long total = packets.size() / FT_SIZE;
+  const char *data = packets.data();
+
+  auto start = chrono::steady_clock::now();
+  for (long i = 0; i < total; i++) {
+    single->increment(data + i * FT_SIZE);
+  }
+  auto end = chrono::steady_clock::now();
+  double single_seconds = chrono::duration<double>(end - start).count();
+
+  start = chrono::steady_clock::now();
+  batch->increment_batch(data, total);
+  end = chrono::steady_clock::now();
+  double batch_seconds = chrono::duration<double>(end - start).count();
+
+  for (long i = 0; i < total; i += 997) {
+    if (single->query(data + i * FT_SIZE) != batch->query(data + i * FT_SIZE)) {
+      throw std::runtime_error(
+          "Failed sanity check - batch and single increments differ");
+    }
+  }
+
+  fprintf(results, "%s,%d,%d,%E,%E\n", name, counters, hash_functions,
+          (double)total / single_seconds, (double)total / batch_seconds);
+  fflush(results);
+}
+
+// Compares `increment` against `increment_batch` for sketches of 2^14 to 2^26
+// counters (in total, across all rows).
+void batch_performance(char *trace_path, FILE *results) {
+  const int k = 100;
+  const int hash_functions = 4;
+  const long max_packets = 1 << 24;
+
+  vector<char> packets = load_trace(trace_path, max_packets);
+
+  fprintf(results, "sketch,counters,hash functions,single packets per "
+                   "second,batch packets per second\n");
+
+  for (int log_counters = 14; log_counters <= 26; log_counters++) {
+    int counters = 1 << log_counters;
+    int row_width = counters / hash_functions;
+
+    CountMinBaseline *baseline = new CountMinBaseline();
+    CountMinBaseline *baseline_batch = new CountMinBaseline();
+    baseline->initialize(row_width, hash_functions, 10);
+    baseline_batch->initialize(row_width, hash_functions, 10);
+    compare_batch(results, "baseline", counters, hash_functions, baseline,
+                  baseline_batch, packets);
+    delete baseline;
+    delete baseline_batch;
+
+    CountMinFlat *flat = new CountMinFlat(k);
+    CountMinFlat *flat_batch = new CountMinFlat(k);
+    flat->initialize(counters, hash_functions, 10);
+    flat_batch->initialize(counters, hash_functions, 10);
+    compare_batch(results, "flat", counters, hash_functions, flat, flat_batch,
+                  packets);
+    delete flat;
+    delete flat_batch;
+
+    CountMinTopK *traditional = new CountMinTopK(k);
+    CountMinTopK *traditional_batch = new CountMinTopK(k);
+    traditional->initialize(row_width, hash_functions, 10);
+    traditional_batch->initialize(row_width, hash_functions, 10);
+    compare_batch(results, "traditional", counters, hash_functions,
+                  traditional, traditional_batch, packets);
+    delete traditional;
+    delete traditional_batch;
+
+    CountMinBlocked *blocked = new CountMinBlocked(k);
+    CountMinBlocked *blocked_batch = new CountMinBlocked(k);
+    blocked->initialize(counters, hash_functions, 10);
+    blocked_batch->initialize(counters, hash_functions, 10);
+    compare_batch(results, "blocked", counters, hash_functions, blocked,
+                  blocked_batch, packets);
+    delete blocked;
+    delete blocked_batch;
+  }
+
+  fclose(results);
+}
+
+// Times `increment_batch` over the whole trace, returning packets per second.
+template <typename Sketch>
+static double timed_batch(Sketch *sketch, const vector<char> &packets) {
+  long total = packets.size() / FT_SIZE;
+
+  auto start = chrono::steady_clock::now();
+  sketch->increment_batch(packets.data(), total);
+  auto end = chrono::steady_clock::now();
+
+  double seconds = chrono::duration<double>(end - start).count();
+  return (double)total / seconds;
+}
+
+// Compares the throughput of the sketches when their counters are backed by
+// regular pages against (transparent or explicit) huge pages, for sketches of
+// 2^20 to 2^26 counters where TLB misses start to matter.
+void page_mode_performance(char *trace_path, FILE *results) {
+  const int k = 100;
+  const int hash_functions = 4;
+  const long max_packets = 1 << 24;
+
+  vector<char> packets = load_trace(trace_path, max_packets);
+
+  fprintf(results, "sketch,counters,hash functions,page mode,packets per "
+                   "second\n");
+
+  for (int log_counters = 20; log_counters <= 26; log_counters++) {
+    int counters = 1 << log_counters;
+    int row_width = counters / hash_functions;
+
+    for (int m = 0; m <= 2; m++) {
+      PageMode mode = (PageMode)m;
+
+      CountMinBaseline *baseline = new CountMinBaseline();
+      baseline->initialize(row_width, hash_functions, 10, mode);
+      double baseline_throughput = timed_batch(baseline, packets);
+      delete baseline;
+
+      CountMinFlat *flat = new CountMinFlat(k);
+      flat->initialize(counters, hash_functions, 10, per_row_hash, mode);
+      double flat_throughput = timed_batch(flat, packets);
+      delete flat;
+
+      fprintf(results, "baseline,%d,%d,%s,%E\n", counters, hash_functions,
+              page_mode_name(mode).c_str(), baseline_throughput);
+      fprintf(results, "flat,%d,%d,%s,%E\n", counters, hash_functions,
+              page_mode_name(mode).c_str(), flat_throughput);
+      fflush(results);
+    }
+  }
+
+  fclose(results);
+}
+
+// Times `increment_and_query` over the whole trace (as the final experiments
+// update the sketches) and returns the packets per second.
+static double timed_increment_and_query(EvaluatableSketch *sketch,
+                                        const vector<char> &packets) {
+  long total = packets.size() / FT_SIZE;
+  const char *data = packets.data();
+
+  auto start = chrono::steady_clock::now();
+  for (long i = 0; i < total; i++) {
+    sketch->increment_and_query(data + i * FT_SIZE);
+  }
+  auto end = chrono::steady_clock::now();
+
+  double seconds = chrono::duration<double>(end - start).count();
+  return (double)total / seconds;
+}
+
+// Runs `sketch` and `batch_sketch` (identically configured) over the trace and
+// writes one result row. The final counts are compared to `reference` so the
+// implementations are checked to agree.
+static void template_result(FILE *results, const char *name,
+                            const char *implementation, int counters,
+                            int hash_functions, EvaluatableSketch *sketch,
+                            EvaluatableSketch *batch_sketch,
+                            EvaluatableSketch *reference,
+                            const vector<char> &packets) {
+  long total = packets.size() / FT_SIZE;
+  const char *data = packets.data();
+
+  double throughput = timed_increment_and_query(sketch, packets);
+  double batch_throughput = timed_batch(batch_sketch, packets);
+
+  for (long i = 0; i < total; i += 997) {
+    uint64_t expected = reference->query(data + i * FT_SIZE);
+    if (sketch->query(data + i * FT_SIZE) != expected ||
+        batch_sketch->query(data + i * FT_SIZE) != expected) {
+      throw std::runtime_error(
+          "Failed sanity check - sketch implementations differ");
+    }
+  }
+
+  fprintf(results, "%s,%s,%d,%d,%E,%E\n", name, implementation, counters,
+          hash_functions, throughput, batch_throughput);
+  fflush(results);
+}
+
+// Compares the runtime configured sketches of CMS.hpp against the compile time
+// specialised `CountMin` (through the runtime factory, so still behind the
+// virtual interface) for the configurations of the final experiments. A
+// fixed width `CountMin` is also measured for 4 hash functions.
+void template_performance(int mem, char *trace_path, FILE *results) {
+  const int k = 100;
+  const long max_packets = 1 << 24;
+
+  vector<char> packets = load_trace(trace_path, max_packets);
+
+  fprintf(results, "sketch,implementation,counters,hash functions,packets per "
+                   "second,batch packets per second\n");
+
+  for (int i = 1; i <= 10; i++) {
+    CountMinFlat *flat = new CountMinFlat(k);
+    CountMinFlat *flat_batch = new CountMinFlat(k);
+    flat->initialize(mem, i, 10);
+    flat_batch->initialize(mem, i, 10);
+    template_result(results, "flat", "class", mem, i, flat, flat_batch, flat,
+                    packets);
+
+    EvaluatableSketch *flat_template = make_flat_count_min(k, mem, i, 10);
+    EvaluatableSketch *flat_template_batch = make_flat_count_min(k, mem, i, 10);
+    template_result(results, "flat", "template", mem, i, flat_template,
+                    flat_template_batch, flat, packets);
+    delete flat;
+    delete flat_batch;
+    delete flat_template;
+    delete flat_template_batch;
+
+    CountMinTopK *traditional = new CountMinTopK(k);
+    CountMinTopK *traditional_batch = new CountMinTopK(k);
+    traditional->initialize(mem / i, i, 10);
+    traditional_batch->initialize(mem / i, i, 10);
+    template_result(results, "traditional", "class", mem, i, traditional,
+                    traditional_batch, traditional, packets);
+
+    EvaluatableSketch *traditional_template =
+        make_row_count_min(k, mem / i, i, 10);
+    EvaluatableSketch *traditional_template_batch =
+        make_row_count_min(k, mem / i, i, 10);
+    template_result(results, "traditional", "template", mem, i,
+                    traditional_template, traditional_template_batch,
+                    traditional, packets);
+    delete traditional;
+    delete traditional_batch;
+    delete traditional_template;
+    delete traditional_template_batch;
+  }
+
+  // Fixed width sketches of 2^16 counters, the reference is the runtime width
+  // template which has been checked against the classes above.
+  const int fixed_counters = 1 << 16;
+
+  EvaluatableSketch *flat_reference =
+      make_flat_count_min(k, fixed_counters, 4, 10);
+  CountMin<FlatLayout<16>, 4> *flat_fixed = new CountMin<FlatLayout<16>, 4>(k);
+  CountMin<FlatLayout<16>, 4> *flat_fixed_batch =
+      new CountMin<FlatLayout<16>, 4>(k);
+  flat_fixed->initialize(fixed_counters, 10);
+  flat_fixed_batch->initialize(fixed_counters, 10);
+  flat_reference->increment_batch(packets.data(), packets.size() / FT_SIZE);
+  template_result(results, "flat", "fixed width template", fixed_counters, 4,
+                  flat_fixed, flat_fixed_batch, flat_reference, packets);
+  delete flat_reference;
+  delete flat_fixed;
+  delete flat_fixed_batch;
+
+  EvaluatableSketch *row_reference =
+      make_row_count_min(k, fixed_counters / 4, 4, 10);
+  CountMin<RowLayout<14>, 4> *row_fixed = new CountMin<RowLayout<14>, 4>(k);
+  CountMin<RowLayout<14>, 4> *row_fixed_batch =
+      new CountMin<RowLayout<14>, 4>(k);
+  row_fixed->initialize(fixed_counters / 4, 10);
+  row_fixed_batch->initialize(fixed_counters / 4, 10);
+  row_reference->increment_batch(packets.data(), packets.size() / FT_SIZE);
+  template_result(results, "traditional", "fixed width template",
+                  fixed_counters, 4, row_fixed, row_fixed_batch, row_reference,
+                  packets);
+  delete row_reference;
+  delete row_fixed;
+  delete row_fixed_batch;
+
+  fclose(results);
+}
+
+// Compares the hash families on the throughput and the normalized / heavy
+// hitter error of the flat and traditional sketches.
+void hash_family_performance(int mem, char *trace_path, FILE *results) {
+  const int k = 100;
+  const long max_packets = 1 << 25;
+
+  vector<char> packets = load_trace(trace_path, max_packets);
+  long total = packets.size() / FT_SIZE;
+
+  TopK trueTopK(2000);
+  vector<int> actual;
+  count_packets(packets, actual, trueTopK);
+
+  // set phi=0.1%
+  int heavy_hitter_threshold = (int)(0.001 * (double)total);
+
+  fprintf(results, "hash family,variant,hash functions,packets per "
+                   "second,normalized error,heavy hitter error\n");
+
+  for (int f = 0; f < HASH_FAMILY_COUNT; f++) {
+    HashFamily family = (HashFamily)f;
+
+    for (int i = 1; i <= 10; i++) {
+      CountMinFlat *flat = new CountMinFlat(k);
+      flat->initialize(mem, i, 10, per_row_hash, default_pages, family);
+      CountMinTopK *traditional = new CountMinTopK(k);
+      traditional->initialize(mem / i, i, 10, default_pages, family);
+
+      SketchEvaluation *variants[] = {new SketchEvaluation(flat, Flat),
+                                      new SketchEvaluation(traditional,
+                                                           Traditional)};
+
+      for (SketchEvaluation *variant : variants) {
+        double throughput = timed_evaluation(variant, packets, actual);
+        double normalized_error = variant->normalized_error(total);
+        double heavy_hitter_err = variant->heavy_hitter_err_real_world(
+            trueTopK, heavy_hitter_threshold, total);
+
+        fprintf(results, "%s,%s,%d,%E,%E,%E\n",
+                hash_family_name(family).c_str(),
+                variant->variant_name.c_str(), i, throughput, normalized_error,
+                heavy_hitter_err);
+        fflush(results);
+        delete variant;
+      }
+
+      delete flat;
+      delete traditional;
+    }
+  }
+
+  fclose(results);
+}
+
+// Measures the cost of a heavy hitter update, feeding it every packet with its
+// true count so far (what a sketch with no overestimation would report), and
+// the skew estimated from the heavy hitters it ends up with.
+void topk_performance(char *trace_path, FILE *results) {
+  const long max_packets = 1 << 25;
+  const int ks[] = {100, 1000, 2000};
+
+  vector<char> packets = load_trace(trace_path, max_packets);
+  long total = packets.size() / FT_SIZE;
+
+  TopK trueTopK(2000);
+  vector<int> actual;
+  count_packets(packets, actual, trueTopK);
+
+  fprintf(results, "structure,k,updates,nanoseconds per update,gate hit rate,"
+                   "estimated skew\n");
+
+  for (int mode = 0; mode < HEAVY_HITTER_MODE_COUNT; mode++) {
+    for (int k : ks) {
+      HeavyHitters *topK = make_heavy_hitters((HeavyHitterMode)mode, k);
+      const char *data = packets.data();
+
+      auto start = chrono::steady_clock::now();
+      for (long i = 0; i < total; i++) {
+        topK->update(data + i * FT_SIZE, actual[i]);
+      }
+      auto end = chrono::steady_clock::now();
+
+      double seconds = chrono::duration<double>(end - start).count();
+      // Only TopK has an admission gate.
+      double gate_hit_rate = 0.0;
+      if (mode == top_k_heap) {
+        TopK *heap = (TopK *)topK;
+        gate_hit_rate = (double)heap->gated_update_count() /
+                        (double)heap->update_count();
+      }
+
+      TopKView items = topK->descending();
+      double skew = small_set_estimate_skew(total, items.size(), items.begin(),
+                                            items.end());
+
+      fprintf(results, "%s,%d,%ld,%f,%f,%f\n",
+              heavy_hitter_mode_name((HeavyHitterMode)mode).c_str(), k, total,
+              seconds * 1e9 / (double)total, gate_hit_rate, skew);
+      fflush(results);
+      delete topK;
+    }
+  }
+
+  fclose(results);
+}
+
+// Compares the skew estimators on the true top-k of a trace generated with a
+// known `skew`: how long one estimate takes and how far it is from the skew.
+void skew_estimator_performance(char *trace_path, double skew, FILE *results) {
+  const long max_packets = 1 << 25;
+  const int ks[] = {100, 1000, 2000};
+  const int repetitions = 1000;
+
+  vector<char> packets = load_trace(trace_path, max_packets);
+  long total = packets.size() / FT_SIZE;
+
+  TopK trueTopK(2000);
+  vector<int> actual;
+  count_packets(packets, actual, trueTopK);
+
+  fprintf(results, "estimator,k,skew,estimated skew,absolute error,"
+                   "microseconds per estimate\n");
+
+  for (int k : ks) {
+    TopK *topK = new TopK(k);
+    const char *data = packets.data();
+    for (long i = 0; i < total; i++) {
+      topK->update(data + i * FT_SIZE, actual[i]);
+    }
+    for (int estimator = 0; estimator < SKEW_ESTIMATOR_COUNT; estimator++) {
+      double estimate = 0.0;
+
+      auto start = chrono::steady_clock::now();
+      for (int i = 0; i < repetitions; i++) {
+        estimate = estimate_topk_skew((SkewEstimator)estimator, total, *topK);
+      }
+      auto end = chrono::steady_clock::now();
+
+      double seconds = chrono::duration<double>(end - start).count();
+      fprintf(results, "%s,%d,%f,%f,%f,%f\n",
+              skew_estimator_name((SkewEstimator)estimator).c_str(), k, skew,
+              estimate, fabs(estimate - skew),
+              seconds * 1e6 / (double)repetitions);
+      fflush(results);
+    }
+    delete topK;
+  }
+
+  fclose(results);
+}
+
+// Adds up the first 8 bytes of every packet, so the reads cannot be optimised
+// away and the readers can be checked to agree.
+static uint64_t checksum_packets(const char *packets, size_t n) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t word;
+    memcpy(&word, packets + i * FT_SIZE, sizeof(word));
+    sum += word;
+  }
+  return sum;
+}
+
+static void report_trace_read(FILE *results, const char *reader, long packets,
+                              uint64_t checksum,
+                              chrono::steady_clock::time_point start) {
+  auto end = chrono::steady_clock::now();
+  double seconds = chrono::duration<double>(end - start).count();
+  fprintf(results, "%s,%ld,%f,%E,%f,%lu\n", reader, packets, seconds,
+          (double)packets / seconds,
+          (double)packets * FT_SIZE / seconds / 1e9, checksum);
+  fflush(results);
+}
+
+// Compares reading a whole trace with ZipfReader, one streambuf call per
+// packet or per chunk of packets (directly or through the `TracePackets` loop
+// the experiments use), the prefetching reader (through the page cache or with
+// O_DIRECT) and the memory mapped reader, copying the packets out or using
+// them in place chunk by chunk, and optionally reading the compact trace or
+// slices of the indexed trace. No sketch is updated, so this is
+// the cost of the read loop alone. The trace is read once first so every
+// reader sees it in the page cache.
+void trace_read_performance(char *trace_path, char *converted_path,
+                            FILE *results) {
+  const size_t chunk_packets = 4096;
+
+  fprintf(results, "reader,packets,seconds,packets per second,GB per second,"
+                   "checksum\n");
+
+  {
+    MappedTraceReader warm_up(trace_path);
+    checksum_packets(warm_up.packets(), warm_up.packet_count());
+  }
+
+  {
+    auto start = chrono::steady_clock::now();
+    ZipfReader *reader = new ZipfReader(trace_path);
+    long packets = 0;
+    uint64_t checksum = 0;
+    char dest[FT_SIZE];
+    while (reader->read_next_packet(dest) == FT_SIZE) {
+      checksum += checksum_packets(dest, 1);
+      packets++;
+    }
+    delete reader;
+    report_trace_read(results, "ifstream", packets, checksum, start);
+  }
+
+  {
+    auto start = chrono::steady_clock::now();
+    ZipfReader *reader = new ZipfReader(trace_path);
+    long packets = 0;
+    uint64_t checksum = 0;
+    char *chunk = new char[chunk_packets * FT_SIZE];
+    size_t n;
+    while ((n = reader->read_packets(chunk, chunk_packets)) > 0) {
+      checksum += checksum_packets(chunk, n);
+      packets += n;
+    }
+    delete[] chunk;
+    delete reader;
+    report_trace_read(results, "ifstream read_packets", packets, checksum,
+                      start);
+  }
+
+  {
+    auto start = chrono::steady_clock::now();
+    ZipfReader *reader = new ZipfReader(trace_path);
+    long packets = 0;
+    uint64_t checksum = 0;
+    for (char *dest : TracePackets(reader, chunk_packets)) {
+      checksum += checksum_packets(dest, 1);
+      packets++;
+    }
+    delete reader;
+    report_trace_read(results, "ifstream range", packets, checksum, start);
+  }
+
+  if (converted_path != NULL &&
+      trace_has_magic(converted_path, COMPACT_TRACE_MAGIC)) {
+    auto start = chrono::steady_clock::now();
+    CompactTraceReader *reader = new CompactTraceReader(converted_path);
+    long packets = 0;
+    uint64_t checksum = 0;
+    for (char *dest : TracePackets(reader, chunk_packets)) {
+      checksum += checksum_packets(dest, 1);
+      packets++;
+    }
+    delete reader;
+    report_trace_read(results, "compact range", packets, checksum, start);
+  }
+
+  if (converted_path != NULL &&
+      trace_has_magic(converted_path, INDEXED_TRACE_MAGIC)) {
+    TraceIndex index(converted_path);
+
+    // The slices are read by as many threads, the sum of the checksums does
+    // not depend on how the packets are split.
+    int hardware_threads = std::max(1u, thread::hardware_concurrency());
+    for (int slices : {1, hardware_threads}) {
+      auto start = chrono::steady_clock::now();
+      vector<long> packets(slices, 0);
+      vector<uint64_t> checksums(slices, 0);
+      auto read_slice = [&](int slice) {
+        size_t first;
+        size_t last;
+        index.slice_chunks(slice, slices, &first, &last);
+        IndexedTraceReader reader(index, first, last);
+        for (char *dest : TracePackets(&reader, chunk_packets)) {
+          checksums[slice] += checksum_packets(dest, 1);
+          packets[slice]++;
+        }
+      };
+
+      vector<thread> threads;
+      for (int slice = 1; slice < slices; slice++) {
+        threads.emplace_back(read_slice, slice);
+      }
+      read_slice(0);
+      for (thread &t : threads) {
+        t.join();
+      }
+
+      long total = 0;
+      uint64_t checksum = 0;
+      for (int slice = 0; slice < slices; slice++) {
+        total += packets[slice];
+        checksum += checksums[slice];
+      }
+      string name = "indexed " + to_string(slices) + " slices";
+      report_trace_read(results, name.c_str(), total, checksum, start);
+      if (hardware_threads == 1) {
+        break;
+      }
+    }
+  }
+
+  for (int direct = 0; direct <= 1; direct++) {
+    auto start = chrono::steady_clock::now();
+    PrefetchingTraceReader *reader =
+        new PrefetchingTraceReader(trace_path, direct);
+    long packets = 0;
+    uint64_t checksum = 0;
+    for (char *dest : TracePackets(reader, chunk_packets)) {
+      checksum += checksum_packets(dest, 1);
+      packets++;
+    }
+    printf("%s: waited %f seconds for reads in %ld stalls\n",
+           direct ? "prefetch direct" : "prefetch", reader->stall_seconds(),
+           reader->stall_count());
+    delete reader;
+    report_trace_read(results, direct ? "prefetch direct" : "prefetch",
+                      packets, checksum, start);
+  }
+
+  {
+    auto start = chrono::steady_clock::now();
+    MappedTraceReader reader(trace_path);
+    long packets = 0;
+    uint64_t checksum = 0;
+    char dest[FT_SIZE];
+    while (reader.read_next_packet(dest) == FT_SIZE) {
+      checksum += checksum_packets(dest, 1);
+      packets++;
+    }
+    report_trace_read(results, "mmap copy", packets, checksum, start);
+  }
+
+  {
+    auto start = chrono::steady_clock::now();
+    MappedTraceReader reader(trace_path);
+    long packets = 0;
+    uint64_t checksum = 0;
+    for (char *dest : TracePackets(&reader, chunk_packets)) {
+      checksum += checksum_packets(dest, 1);
+      packets++;
+    }
+    report_trace_read(results, "mmap range", packets, checksum, start);
+  }
+
+  for (int populate = 0; populate <= 1; populate++) {
+    auto start = chrono::steady_clock::now();
+    MappedTraceReader reader(trace_path, populate);
+    long packets = 0;
+    uint64_t checksum = 0;
+    const char *chunk;
+    size_t n;
+    while ((n = reader.next_chunk(&chunk, chunk_packets)) > 0) {
+      checksum += checksum_packets(chunk, n);
+      packets += n;
+    }
+    report_trace_read(results,
+                      populate ? "mmap chunks populate" : "mmap chunks",
+                      packets, checksum, start);
+  }
+
+  fclose(results);
+}
+
+// Times `sketch` updating every packet uncached (each variant in its own pass
+// over the trace, so no variant pays for hashes another computed) and writes
+// one result row. `batch_sketch` is configured the same and times
+// `increment_batch`.
+static void conservative_result(FILE *results, const char *name,
+                                EvaluatableSketch *sketch,
+                                EvaluatableSketch *batch_sketch,
+                                const vector<char> &packets,
+                                const vector<int> &actual,
+                                HeavyHitters &trueTopK) {
+  long total = actual.size();
+  // set phi=0.1%
+  int heavy_hitter_threshold = (int)(0.001 * (double)total);
+
+  SketchEvaluation *variant = new SketchEvaluation(sketch, Flat);
+  double throughput = timed_evaluation(variant, packets, actual);
+  double batch_throughput = timed_batch(batch_sketch, packets);
+  double normalized_error = variant->normalized_error(total);
+  double heavy_hitter_err = variant->heavy_hitter_err_real_world(
+      trueTopK, heavy_hitter_threshold, total);
+
+  fprintf(results, "%s,%d,%E,%E,%E,%E\n", name,
+          sketch->get_hash_function_count(), throughput, batch_throughput,
+          normalized_error, heavy_hitter_err);
+  fflush(results);
+  delete variant;
+}
+
+// Compares the throughput (and error) of conservative update against plain
+// update for the flat and dynamic sketches of the final experiments.
+void conservative_performance(int mem, char *trace_path, FILE *results) {
+  const int k = 100;
+  const long max_packets = 1 << 25;
+
+  vector<char> packets = load_trace(trace_path, max_packets);
+
+  TopK trueTopK(2000);
+  vector<int> actual;
+  count_packets(packets, actual, trueTopK);
+
+  fprintf(results, "variant,hash functions,packets per second,batch packets "
+                   "per second,normalized error,heavy hitter error\n");
+
+  for (int i = 1; i < 10; i++) {
+    CountMinFlat *flat = new CountMinFlat(k);
+    CountMinFlat *flat_batch = new CountMinFlat(k);
+    flat->initialize(mem, i, 10);
+    flat_batch->initialize(mem, i, 10);
+    conservative_result(results, "flat", flat, flat_batch, packets, actual,
+                        trueTopK);
+    delete flat;
+    delete flat_batch;
+
+    CountMinConservative *conservative = new CountMinConservative(k);
+    CountMinConservative *conservative_batch = new CountMinConservative(k);
+    conservative->initialize(mem, i, 10);
+    conservative_batch->initialize(mem, i, 10);
+    conservative_result(results, "conservative", conservative,
+                        conservative_batch, packets, actual, trueTopK);
+    delete conservative;
+    delete conservative_batch;
+  }
+
+  for (int c = 0; c <= 1; c++) {
+    bool conservative = c == 1;
+    DynamicCountMin *dynamic = new DynamicCountMin(k, normalized, true,
+                                                   conservative);
+    DynamicCountMin *dynamic_batch = new DynamicCountMin(k, normalized, true,
+                                                         conservative);
+    dynamic->initialize(mem, 4, 10);
+    dynamic_batch->initialize(mem, 4, 10);
+    conservative_result(results,
+                        conservative ? "dynamic-conservative" : "dynamic",
+                        dynamic, dynamic_batch, packets, actual, trueTopK);
+    delete dynamic;
+    delete dynamic_batch;
+  }
+
+  fclose(results);
+}
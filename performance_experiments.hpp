@@ -0,0 +1,30 @@
+#pragma once
+
+#include "final_experiments.hpp"
+
+/*
+ * Experiments measuring the throughput of the sketches rather than (only) their
+ * error.
+ */
+
+void index_mode_performance(int mem, char *trace_path, FILE *results);
+
+// Measured apart from the final experiments, whose variants share hashes.
+void conservative_performance(int mem, char *trace_path, FILE *results);
+
+void batch_performance(char *trace_path, FILE *results);
+
+void page_mode_performance(char *trace_path, FILE *results);
+
+void template_performance(int mem, char *trace_path, FILE *results);
+
+void hash_family_performance(int mem, char *trace_path, FILE *results);
+
+void topk_performance(char *trace_path, FILE *results);
+
+void skew_estimator_performance(char *trace_path, double skew, FILE *results);
+
+// `converted_path` (optional) is the same trace converted with
+// `compact_trace` or `index_trace`, adding reading it to the comparison.
+void trace_read_performance(char *trace_path, char *converted_path,
+                            FILE *results);
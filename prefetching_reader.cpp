@@ -0,0 +1,198 @@
+#include "prefetching_reader.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+PrefetchingTraceReader::PrefetchingTraceReader(const char *path, bool direct,
+                                               int buffer_count,
+                                               size_t buffer_size) {
+  assert(buffer_count >= 2 && "PrefetchingTraceReader: need two buffers!");
+  assert(buffer_size % 4096 == 0 &&
+         "PrefetchingTraceReader: buffer size must be 4096 aligned!");
+
+  this->fd = -1;
+#ifdef O_DIRECT
+  if (direct) {
+    fd = open(path, O_RDONLY | O_DIRECT);
+  }
+#endif
+  // Without O_DIRECT support (or on a file system refusing it) fall back to
+  // buffered reads.
+  this->direct = fd >= 0;
+  if (fd < 0) {
+    fd = open(path, O_RDONLY);
+  }
+  if (fd < 0) {
+    std::string msg = "Failed to open zipf file for reading --";
+    msg += path;
+    msg += "--";
+    throw std::runtime_error(msg);
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  if (!this->direct) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+#endif
+
+  this->buffer_size = buffer_size;
+  buffers.resize(buffer_count);
+  for (Buffer &buffer : buffers) {
+    void *data;
+    if (posix_memalign(&data, 4096, buffer_size) != 0) {
+      throw std::bad_alloc();
+    }
+    buffer.data = (char *)data;
+    buffer.size = 0;
+    buffer.filled = false;
+  }
+
+  this->stopping = false;
+  this->producer_wait = 0.0;
+  this->current = 0;
+  // Like ZipfReader the first record is skipped.
+  this->position = FT_SIZE;
+  this->holding = false;
+  this->finished = false;
+  this->consumer_wait = 0.0;
+  this->consumer_stalls = 0;
+
+  thread = std::thread(&PrefetchingTraceReader::run, this);
+}
+
+PrefetchingTraceReader::~PrefetchingTraceReader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  emptied_cv.notify_one();
+  thread.join();
+
+  for (Buffer &buffer : buffers) {
+    free(buffer.data);
+  }
+  close(fd);
+}
+
+void PrefetchingTraceReader::run() {
+  off_t offset = 0;
+  bool at_end = false;
+  for (int slot = 0;; slot = (slot + 1) % buffers.size()) {
+    Buffer &buffer = buffers[slot];
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (buffer.filled && !stopping) {
+        auto start = std::chrono::steady_clock::now();
+        emptied_cv.wait(lock, [&] { return !buffer.filled || stopping; });
+        producer_wait += std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+      }
+      if (stopping) {
+        return;
+      }
+    }
+
+    // The buffer is the thread's until it is marked filled. Only the read at
+    // the end of the trace comes up short, so O_DIRECT offsets stay aligned,
+    // and the buffer after it is left empty to mark the end.
+    size_t size = 0;
+    std::string failure;
+    while (!at_end && size < buffer_size) {
+      ssize_t n = pread(fd, buffer.data + size, buffer_size - size, offset);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        failure = std::string("Failed to read trace: ") + strerror(errno);
+        break;
+      }
+      if (n == 0) {
+        break;
+      }
+      size += n;
+      offset += n;
+    }
+    at_end = size < buffer_size;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      buffer.size = failure.empty() ? size : 0;
+      buffer.filled = true;
+      if (!failure.empty()) {
+        error = failure;
+      }
+    }
+    filled_cv.notify_one();
+
+    if (size == 0 || !failure.empty()) {
+      return;
+    }
+  }
+}
+
+bool PrefetchingTraceReader::acquire() {
+  while (!finished) {
+    if (holding) {
+      if (position < buffers[current].size) {
+        return true;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        buffers[current].filled = false;
+      }
+      emptied_cv.notify_one();
+      holding = false;
+      current = (current + 1) % buffers.size();
+      position = 0;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!buffers[current].filled) {
+      auto start = std::chrono::steady_clock::now();
+      filled_cv.wait(lock, [this] { return buffers[current].filled; });
+      consumer_wait += std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+      consumer_stalls++;
+    }
+    if (buffers[current].size == 0) {
+      if (!error.empty()) {
+        throw std::runtime_error(error);
+      }
+      finished = true;
+    } else {
+      holding = true;
+    }
+  }
+  return false;
+}
+
+size_t PrefetchingTraceReader::read_packets(char *dest, size_t max) {
+  size_t bytes = max * FT_SIZE;
+  size_t copied = 0;
+  while (copied < bytes && acquire()) {
+    size_t n = std::min(bytes - copied, buffers[current].size - position);
+    memcpy(dest + copied, buffers[current].data + position, n);
+    copied += n;
+    position += n;
+  }
+  // A partial packet at the end of the trace is dropped.
+  return copied / FT_SIZE;
+}
+
+int PrefetchingTraceReader::read_next_packet(char *dest) {
+  return read_packets(dest, 1) * FT_SIZE;
+}
+
+double PrefetchingTraceReader::io_idle_seconds() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return producer_wait;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TraceReader.hpp"
+
+/// Reads a trace on a dedicated I/O thread, which fills a ring of large
+/// aligned buffers with `pread` ahead of the consumer, so the consumer only
+/// waits on the disk when it gets ahead of the thread.
+///
+/// With `direct` the trace is opened with O_DIRECT (where the file system
+/// supports it) and bypasses the page cache, otherwise the kernel is told the
+/// reads are sequential. The packets are the same as ZipfReader's.
+class PrefetchingTraceReader : public PacketReader {
+  struct Buffer {
+    char *data;
+    // Bytes read into `data`, 0 for the end of the trace.
+    size_t size;
+    // Owned by the consumer while set, by the I/O thread otherwise.
+    bool filled;
+  };
+
+  int fd;
+  bool direct;
+  size_t buffer_size;
+  std::vector<Buffer> buffers;
+
+  std::mutex mutex;
+  std::condition_variable filled_cv;
+  std::condition_variable emptied_cv;
+  // Guarded by `mutex`.
+  bool stopping;
+  std::string error;
+  double producer_wait;
+
+  // The consumer's position, `buffers[current]` is only read while `holding`.
+  int current;
+  size_t position;
+  bool holding;
+  bool finished;
+
+  double consumer_wait;
+  long consumer_stalls;
+
+  std::thread thread;
+
+  void run();
+  // Makes `buffers[current]` hold unread bytes, waiting for the I/O thread if
+  // needed. Returns false at the end of the trace.
+  bool acquire();
+
+public:
+  // `buffer_size` must be a multiple of 4096 (the O_DIRECT alignment).
+  PrefetchingTraceReader(const char *path, bool direct = false,
+                         int buffer_count = 4, size_t buffer_size = 8 << 20);
+  // Stops and joins the thread.
+  ~PrefetchingTraceReader();
+
+  int read_next_packet(char *dest);
+  size_t read_packets(char *dest, size_t max);
+
+  // Whether the trace is read with O_DIRECT.
+  bool is_direct() const { return direct; }
+  // How long, and how many times, the consumer waited for the I/O thread.
+  double stall_seconds() const { return consumer_wait; }
+  long stall_count() const { return consumer_stalls; }
+  // How long the I/O thread waited for the consumer to free a buffer.
+  double io_idle_seconds();
+};
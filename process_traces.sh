@@ -1,4 +1,4 @@
 
 gunzip -f data.pcap.gz
-tcpdump -q -n -t -r data.pcap | grep IP | sed 's/\./ /g' | awk '{print $2" "$3" "$4" "$5"\t"$8" "$9" "$10" "$11}' | grep -v "[a-z:]" > trace 2> /dev/null
+builddir/fyp convert_pcap data.pcap trace
 rm data.pcap #save space
\ No newline at end of file
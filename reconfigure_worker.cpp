@@ -0,0 +1,76 @@
+#include "reconfigure_worker.hpp"
+
+ReconfigureWorker::ReconfigureWorker(ErrorMetric metric, bool use_bounds)
+    : decision(0), decision_skew(0.0) {
+  this->metric = metric;
+  this->use_bounds = use_bounds;
+  this->snapshot_total = 0;
+  this->snapshot_estimator = grid_skew_estimator;
+  this->snapshot_ready = false;
+  this->stopping = false;
+
+  thread = std::thread(&ReconfigureWorker::run, this);
+}
+
+ReconfigureWorker::~ReconfigureWorker() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_one();
+  thread.join();
+}
+
+bool ReconfigureWorker::publish(const TopKView &items, int total,
+                                SkewEstimator estimator) {
+  std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+  if (!lock.owns_lock() || snapshot_ready) {
+    return false;
+  }
+
+  snapshot.assign(items.begin(), items.end());
+  snapshot_total = total;
+  snapshot_estimator = estimator == incremental_skew_estimator
+                           ? regression_skew_estimator
+                           : estimator;
+  snapshot_ready = true;
+  lock.unlock();
+
+  wake.notify_one();
+  return true;
+}
+
+void ReconfigureWorker::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wake.wait(lock, [this] { return snapshot_ready || stopping; });
+    if (stopping) {
+      return;
+    }
+
+    // The snapshot stays owned by the worker until `snapshot_ready` is
+    // cleared, so the estimate runs without holding the lock.
+    lock.unlock();
+
+    int k = snapshot.size();
+    double skew;
+    if (snapshot_estimator == regression_skew_estimator) {
+      skew = regression_estimate_skew(snapshot_total, k, snapshot.cbegin(),
+                                      snapshot.cend());
+    } else {
+      skew = small_set_estimate_skew(snapshot_total, k, snapshot.cbegin(),
+                                     snapshot.cend());
+    }
+
+    int lower = 0;
+    int upper = 0;
+    int best = 0;
+    optimal_bounds(skew, &upper, &lower, &best, metric);
+
+    decision_skew.store(skew, std::memory_order_relaxed);
+    decision.store(use_bounds ? lower : best, std::memory_order_release);
+
+    lock.lock();
+    snapshot_ready = false;
+  }
+}
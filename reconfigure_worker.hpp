@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "heavy_hitters.hpp"
+#include "optimal_parameters.hpp"
+#include "skew_estimation.hpp"
+
+/// Decides the configuration of a dynamic sketch on a background thread, so
+/// that estimating the skew never stalls the thread updating the sketch.
+///
+/// The sketch hands over a copy of its top-k with `publish`, which never
+/// waits: a snapshot published while the worker is still busy with the
+/// previous one is dropped. The worker estimates the skew, picks the number of
+/// hash functions with `optimal_bounds` and posts it back through an atomic
+/// that the sketch polls with `take_decision`.
+class ReconfigureWorker {
+  ErrorMetric metric;
+  bool use_bounds;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  // Guarded by `mutex`.
+  std::vector<TopKItem> snapshot;
+  int snapshot_total;
+  SkewEstimator snapshot_estimator;
+  bool snapshot_ready;
+  bool stopping;
+
+  // The hash count decided for the last snapshot, 0 until there is one, and
+  // the skew it was decided for (written before it).
+  std::atomic<int> decision;
+  std::atomic<double> decision_skew;
+
+  std::thread thread;
+
+  void run();
+
+public:
+  // Starts the thread.
+  ReconfigureWorker(ErrorMetric metric, bool use_bounds);
+  // Stops and joins the thread.
+  ~ReconfigureWorker();
+
+  // Hands `items` (the top-k out of `total` packets) to the worker, returns
+  // false if it was still busy. The incremental estimator reads state the
+  // worker cannot share, the worker runs the regression instead.
+  bool publish(const TopKView &items, int total, SkewEstimator estimator);
+
+  // The hash count decided since the last call, and the skew it was decided
+  // for, or 0 if there is none.
+  int take_decision(double *skew) {
+    if (decision.load(std::memory_order_relaxed) == 0) {
+      return 0;
+    }
+    int hash_count = decision.exchange(0, std::memory_order_acquire);
+    *skew = decision_skew.load(std::memory_order_relaxed);
+    return hash_count;
+  }
+};
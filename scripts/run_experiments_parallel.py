@@ -387,52 +387,8 @@ def lower_upper_bounds(output_dir, result_dirs):
                 f.write(f"{skew},{val}\n")
                         
 def convert_pcap_task(pcap, converted_path):
-    #decompressed = pcap.removesuffix(".gz")
-    # subprocess.run(["gunzip", "-f", decompressed])
-    # print("unzipped")
-    args = ["bash", "-c", f"""tcpdump -q -n -t -r {pcap} | grep IP[^6] | sed 's/\\./ /g' | awk '{{print $2" "$3" "$4" "$5"-"$6"\\t"$8" "$9" "$10" "$11"-"$12""$13}}'"""]
-    print(" ".join(map(lambda arg: '"' + arg + '"', args)))
-    process = subprocess.Popen(args, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
-
-    def decode_line(line: str):
-        def decode_address_port(address_port):
-            [address, port] = address_port.split("-")
-            port = int(port)
-            address = [int(part) for part in address.split(" ")]
-            return (address, port)
-
-        [addresses, protocol] = line.split(":")
-        protocol = "".join([c for c in protocol if c.isalpha()])
-        [source, destination] = map(lambda address: decode_address_port(address), addresses.split("\t"))
-
-        protocol_number = 0 if protocol == "udp" else 1
-
-        return (source, destination, protocol_number)
-
-    def encode_address_port(address):
-        (address, port) = address
-        parts = [part.to_bytes(1, "big") for part in address] + [port.to_bytes(2, "big")]
-        # print(parts)
-        # print(b"".join(parts))
-        #return bytearray([byte for bytes in parts for byte in bytes])
-        return b"".join(parts)
-
-    with open(converted_path, "wb") as binary_file:
-        while True:
-            line = process.stdout.readline().decode().lower()
-            if not line:
-                break
-            
-            if "udp" not in line and "tcp" not in line:
-                continue
-
-            #print(line)
-            (source, destination, protocol) = decode_line(line)
-            #print(f"source={source}, destination={destination}, protocol={protocol}")
-            binary_file.write(encode_address_port(source))
-            binary_file.write(encode_address_port(destination))
-            binary_file.write(protocol.to_bytes(1, "big"))
-            
+    # The captures are converted in parallel, so each conversion uses one thread.
+    run_bin(["convert_pcap", pcap, converted_path, 1])
 
 
 def convert_pcap_gz(pcap_folder, output_dir):
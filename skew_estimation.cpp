@@ -1,12 +1,81 @@
 #include "skew_estimation.hpp"
 
+#include <functional>
 #include <limits>
+#include <stdexcept>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SKEW_COSTS_AVX2
+#include <immintrin.h>
+#endif
+
+std::string skew_estimator_name(SkewEstimator estimator) {
+  switch (estimator) {
+  case grid_skew_estimator:
+    return "grid";
+  case regression_skew_estimator:
+    return "regression";
+  case incremental_skew_estimator:
+    return "incremental";
+  }
+  throw std::runtime_error("invalid skew estimator");
+}
+
+SkewEstimator parse_skew_estimator(const char *name) {
+  for (int i = 0; i < SKEW_ESTIMATOR_COUNT; i++) {
+    if (skew_estimator_name((SkewEstimator)i) == name) {
+      return (SkewEstimator)i;
+    }
+  }
+  throw std::runtime_error(std::string("Unknown skew estimator ") + name);
+}
+
+// log(rank) for ranks 1 to LOG_RANK_TABLE_SIZE (well above the k of the
+// experiments), larger ranks are computed when needed.
+const int LOG_RANK_TABLE_SIZE = 4096;
+
+static double log_rank(int rank) {
+  static const vector<double> table = []() {
+    vector<double> logs(LOG_RANK_TABLE_SIZE);
+    for (int i = 0; i < LOG_RANK_TABLE_SIZE; i++) {
+      logs[i] = log((double)(i + 1));
+    }
+    return logs;
+  }();
+  return rank <= LOG_RANK_TABLE_SIZE ? table[rank - 1] : log((double)rank);
+}
+
+void RegressionSums::add(int rank, uint32_t count, double log_count,
+                         double sign) {
+  if (count == 0) {
+    return;
+  }
 
-double debuging_estimate_harmonic_number(
-    int N, int k, double skew,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator start,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator end,
-    FILE *output) {
+  double log_r = log_rank(rank);
+  double weight = sign * (double)count;
+
+  w += weight;
+  x += weight * log_r;
+  y += weight * log_count;
+  xx += weight * log_r * log_r;
+  xy += weight * log_r * log_count;
+}
+
+double RegressionSums::skew() const {
+  double denominator = w * xx - x * x;
+  if (denominator <= 0.0) {
+    // Fewer than two distinct ranks with a count.
+    return 0.0;
+  }
+
+  double slope = (w * xy - x * y) / denominator;
+  return std::max(-slope, 0.0);
+}
+
+template <class Iterator>
+double debuging_estimate_harmonic_number(int N, int k, double skew,
+                                         Iterator first, Iterator last,
+                                         FILE *output) {
   assert(skew < 1.5);
 
   int i = 0;
@@ -14,8 +83,7 @@ double debuging_estimate_harmonic_number(
   double inv_total = 1.0 / (double)N;
 
   std::vector<double> estimates;
-  //  Loop in inverse order since largest is at the end
-  for (auto it = --end; it >= start; --it) {
+  for (auto it = first; it != last; ++it) {
     i++;
     uint32_t count = it->second;
     double frequency = (double)count * inv_total;
@@ -32,18 +100,16 @@ double debuging_estimate_harmonic_number(
   return median;
 }
 
-double estimate_harmonic_number(
-    int N, int k, double skew,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator start,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator end) {
+template <class Iterator>
+double estimate_harmonic_number(int N, int k, double skew, Iterator first,
+                                Iterator last) {
   assert(skew < 1.5);
   int i = 0;
 
   double inv_total = 1.0 / (double)N;
 
   std::vector<double> estimates;
-  //  Loop in inverse order since largest is at the end
-  for (auto it = --end; it >= start; --it) {
+  for (auto it = first; it != last; ++it) {
     i++;
     uint32_t count = it->second;
     double frequency = (double)count * inv_total;
@@ -59,10 +125,9 @@ double estimate_harmonic_number(
   return median;
 }
 
-double harmonic_number_variance(
-    int N, int k, double skew,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator start,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator end) {
+template <class Iterator>
+double harmonic_number_variance(int N, int k, double skew, Iterator first,
+                                Iterator last) {
   int i = 0;
 
   double inv_total = 1.0 / (double)N;
@@ -70,8 +135,7 @@ double harmonic_number_variance(
 
   std::vector<double> estimates;
   estimates.reserve(k);
-  //  Loop in inverse order since largest is at the end
-  for (auto it = --end; it >= start; --it) {
+  for (auto it = first; it != last; ++it) {
     i++;
     uint32_t count = it->second;
     double frequency = (double)count * inv_k;
@@ -95,25 +159,122 @@ double harmonic_number_variance(
   return var;
 }
 
-double cost_topk_skew(
-    int N, int k, double skew_d,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator start,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator end) {
+template <class Iterator>
+double cost_topk_skew(int N, int k, double skew_d, Iterator first,
+                      Iterator last) {
   assert(skew_d < 1.8);
-  return harmonic_number_variance(N, k, skew_d, start, end);
+  return harmonic_number_variance(N, k, skew_d, first, last);
+}
+
+// Adds an item's estimates `scale * power * step^j` for the `skew_count`
+// skews to the sums, relative to the first item's (`shift`, set when `first`).
+static void add_skew_estimates_scalar(double scale, double power, double step,
+                                      int skew_count, bool first,
+                                      double *shift, double *sum,
+                                      double *sum_sq) {
+  for (int j = 0; j < skew_count; j++) {
+    if (first) {
+      shift[j] = scale * power;
+    }
+    double estimate = scale * power - shift[j];
+    sum[j] += estimate;
+    sum_sq[j] += estimate * estimate;
+    power *= step;
+  }
+}
+
+#ifdef SKEW_COSTS_AVX2
+
+// Four skews per vector, so the power recurrence advances by step^4 and only
+// one multiply in four waits on the previous one. The arrays are read and
+// written in whole vectors, up to `skew_count` rounded up to 4.
+__attribute__((target("avx2"))) static void
+add_skew_estimates_avx2(double scale, double power, double step,
+                        int skew_count, bool first, double *shift, double *sum,
+                        double *sum_sq) {
+  double step2 = step * step;
+  __m256d powers =
+      _mm256_set_pd(power * step2 * step, power * step2, power * step, power);
+  __m256d step4 = _mm256_set1_pd(step2 * step2);
+  __m256d scales = _mm256_set1_pd(scale);
+
+  for (int j = 0; j < skew_count; j += 4) {
+    __m256d scaled = _mm256_mul_pd(scales, powers);
+    if (first) {
+      _mm256_storeu_pd(shift + j, scaled);
+    }
+    __m256d estimate = _mm256_sub_pd(scaled, _mm256_loadu_pd(shift + j));
+    _mm256_storeu_pd(sum + j,
+                     _mm256_add_pd(_mm256_loadu_pd(sum + j), estimate));
+    _mm256_storeu_pd(sum_sq + j,
+                     _mm256_add_pd(_mm256_loadu_pd(sum_sq + j),
+                                   _mm256_mul_pd(estimate, estimate)));
+    powers = _mm256_mul_pd(powers, step4);
+  }
+}
+
+static bool skew_costs_use_avx2() {
+  static bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+
+#endif
+
+static_assert(MAX_SKEW_CANDIDATES % 4 == 0,
+              "the AVX2 skew costs write whole vectors");
+
+template <class Iterator>
+void cost_topk_skews(int N, int k, double first_skew, double skew_step,
+                     int skew_count, Iterator first, Iterator last,
+                     double *costs) {
+  assert(skew_count > 0 && skew_count <= MAX_SKEW_CANDIDATES);
+  assert(first_skew + (skew_count - 1) * skew_step < 1.8);
+  (void)N;
+
+  // The estimates are summed relative to the first item's (per skew), which
+  // keeps the one pass variance as accurate as the two pass one.
+  double shift[MAX_SKEW_CANDIDATES];
+  double sum[MAX_SKEW_CANDIDATES] = {};
+  double sum_sq[MAX_SKEW_CANDIDATES] = {};
+
+  int i = 0;
+  for (auto it = first; it != last; ++it) {
+    i++;
+    // i^-skew for every skew, from the first by the recurrence
+    // i^-(skew + step) = i^-skew * i^-step, so each item costs two exp calls
+    // rather than one pow per skew.
+    double log_i = log_rank(i);
+    double step = exp(-skew_step * log_i);
+    double power = exp(-first_skew * log_i);
+
+    // 1 / ((count / k) * i^skew), as in `harmonic_number_variance`.
+    double scale = (double)k / (double)it->second;
+#ifdef SKEW_COSTS_AVX2
+    if (skew_costs_use_avx2()) {
+      add_skew_estimates_avx2(scale, power, step, skew_count, i == 1, shift,
+                              sum, sum_sq);
+      continue;
+    }
+#endif
+    add_skew_estimates_scalar(scale, power, step, skew_count, i == 1, shift,
+                              sum, sum_sq);
+  }
+  assert(i == k);
+
+  for (int j = 0; j < skew_count; j++) {
+    costs[j] = sum_sq[j] - sum[j] * sum[j] / (double)k;
+  }
 }
 
-double cost_topk_skew_old(
-    int N, int k, double skew, double harmonic_n,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator start,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator end) {
+template <class Iterator>
+double cost_topk_skew_old(int N, int k, double skew, double harmonic_n,
+                          Iterator first, Iterator last) {
   double cost = 0.0;
   double inv_harmonic_n = 1.0 / harmonic_n;
   double inv_n = 1.0 / (double)N;
 
   int i = 0;
-  //  Loop in inverse order since largest is at the end
-  for (auto it = end; it != start; --it) {
+  for (auto it = first; it != last; ++it) {
     i++;
     uint32_t count = it->second;
     double expected = inv_harmonic_n / (pow((double)i, skew));
@@ -128,10 +289,8 @@ double cost_topk_skew_old(
   return cost / (float)k;
 }
 
-double small_set_estimate_skew(
-    int N, int k,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator start,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator end) {
+template <class Iterator>
+double small_set_estimate_skew(int N, int k, Iterator first, Iterator last) {
   int steps = 10;
   double skew_start = 0.5;
   double delta_skew = 0.1;
@@ -139,10 +298,13 @@ double small_set_estimate_skew(
   double best_skew = 0.0;
   double best_skew_cost = std::numeric_limits<double>::infinity();
 
+  double costs[MAX_SKEW_CANDIDATES];
+  cost_topk_skews(N, k, skew_start, delta_skew, steps + 1, first, last, costs);
+
   for (int i = 0; i <= steps; i++) {
     double skew = skew_start + i * delta_skew;
 
-    double cost = cost_topk_skew(N, k, skew, start, end);
+    double cost = costs[i];
 
     if (cost < best_skew_cost) {
       best_skew = skew;
@@ -153,10 +315,9 @@ double small_set_estimate_skew(
   return best_skew;
 }
 
-double binary_search_estimate_skew(
-    int N, int k,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator start,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator end) {
+template <class Iterator>
+double binary_search_estimate_skew(int N, int k, Iterator first,
+                                   Iterator last) {
   const double skew_grad_delta = 0.0001;
   const int MAX_ITERS = 10;
   double bottom = 0.5;
@@ -165,9 +326,9 @@ double binary_search_estimate_skew(
   for (int i = 0; i < MAX_ITERS; i++) {
     double skew_f = (bottom + top) * 0.5;
 
-    double cost = cost_topk_skew(N, k, skew_f, start, end);
+    double cost = cost_topk_skew(N, k, skew_f, first, last);
     double cost_plus_delta =
-        cost_topk_skew(N, k, skew_f + skew_grad_delta, start, end);
+        cost_topk_skew(N, k, skew_f + skew_grad_delta, first, last);
 
     if (cost < cost_plus_delta) {
       // Cost is decreasing with a decreasing skew
@@ -182,3 +343,127 @@ double binary_search_estimate_skew(
 
   return (bottom + top) * 0.5;
 }
+
+template <class Iterator>
+double regression_estimate_skew(int N, int k, Iterator first, Iterator last) {
+  (void)N;
+  RegressionSums sums;
+
+  int i = 0;
+  for (auto it = first; it != last; ++it) {
+    i++;
+    uint32_t count = it->second;
+    sums.add(i, count, count == 0 ? 0.0 : log((double)count), 1.0);
+  }
+  assert(i == k);
+
+  return sums.skew();
+}
+
+void IncrementalSkewEstimator::add_range(int first, int last, double sign) {
+  for (int i = first; i < last; i++) {
+    sums.add(i + 1, counts[i], log_counts[i], sign);
+  }
+}
+
+void IncrementalSkewEstimator::insert(uint32_t count) {
+  // After the counts >= `count`, usually at the end since new items come in
+  // with the smallest counts.
+  int position = upper_bound(counts.begin(), counts.end(), count,
+                             greater<uint32_t>()) -
+                 counts.begin();
+  int size = counts.size();
+
+  add_range(position, size, -1.0);
+  counts.insert(counts.begin() + position, count);
+  log_counts.insert(log_counts.begin() + position, log((double)count));
+  add_range(position, size + 1, 1.0);
+}
+
+void IncrementalSkewEstimator::change(uint32_t old_count, uint32_t new_count) {
+  if (old_count == new_count) {
+    return;
+  }
+
+  int first;
+  int last;
+  if (new_count > old_count) {
+    // The first `old_count` becomes `new_count` after the counts above it that
+    // are still below `new_count` shift down one rank.
+    first = upper_bound(counts.begin(), counts.end(), new_count,
+                        greater<uint32_t>()) -
+            counts.begin();
+    last = lower_bound(counts.begin(), counts.end(), old_count,
+                       greater<uint32_t>()) -
+           counts.begin();
+    assert(last < (int)counts.size() && counts[last] == old_count);
+
+    add_range(first, last + 1, -1.0);
+    for (int i = last; i > first; i--) {
+      counts[i] = counts[i - 1];
+      log_counts[i] = log_counts[i - 1];
+    }
+    counts[first] = new_count;
+    log_counts[first] = log((double)new_count);
+    add_range(first, last + 1, 1.0);
+  } else {
+    // The last `old_count` becomes `new_count` before the counts below it that
+    // are still above `new_count` shift up one rank.
+    first = upper_bound(counts.begin(), counts.end(), old_count,
+                        greater<uint32_t>()) -
+            counts.begin() - 1;
+    last = lower_bound(counts.begin(), counts.end(), new_count,
+                       greater<uint32_t>()) -
+           counts.begin() - 1;
+    assert(first >= 0 && counts[first] == old_count);
+
+    add_range(first, last + 1, -1.0);
+    for (int i = first; i < last; i++) {
+      counts[i] = counts[i + 1];
+      log_counts[i] = log_counts[i + 1];
+    }
+    counts[last] = new_count;
+    log_counts[last] = log((double)new_count);
+    add_range(first, last + 1, 1.0);
+  }
+}
+
+double estimate_topk_skew(SkewEstimator estimator, int N,
+                          HeavyHitters &top_k) {
+  if (estimator == incremental_skew_estimator) {
+    return top_k.tracked_skew();
+  }
+
+  TopKView items = top_k.descending();
+  switch (estimator) {
+  case grid_skew_estimator:
+    return small_set_estimate_skew(N, items.size(), items.begin(),
+                                   items.end());
+  case regression_skew_estimator:
+    return regression_estimate_skew(N, items.size(), items.begin(),
+                                    items.end());
+  case incremental_skew_estimator:
+    break;
+  }
+  throw std::runtime_error("invalid skew estimator");
+}
+
+#define INSTANTIATE_SKEW_ESTIMATORS(Iterator)                                  \
+  template double debuging_estimate_harmonic_number(int, int, double,          \
+                                                    Iterator, Iterator,        \
+                                                    FILE *);                   \
+  template double estimate_harmonic_number(int, int, double, Iterator,         \
+                                           Iterator);                          \
+  template double harmonic_number_variance(int, int, double, Iterator,         \
+                                           Iterator);                          \
+  template double cost_topk_skew(int, int, double, Iterator, Iterator);        \
+  template void cost_topk_skews(int, int, double, double, int, Iterator,       \
+                                Iterator, double *);                           \
+  template double cost_topk_skew_old(int, int, double, double, Iterator,       \
+                                     Iterator);                                \
+  template double small_set_estimate_skew(int, int, Iterator, Iterator);       \
+  template double binary_search_estimate_skew(int, int, Iterator, Iterator);  \
+  template double regression_estimate_skew(int, int, Iterator, Iterator);
+
+INSTANTIATE_SKEW_ESTIMATORS(TopKIterator)
+INSTANTIATE_SKEW_ESTIMATORS(ItemsReverseIterator)
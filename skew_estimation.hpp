@@ -1,44 +1,127 @@
 #pragma once
 
 #include "Defs.hpp"
+#include "heavy_hitters.hpp"
 #include <algorithm>
 #include <array>
 #include <assert.h>
 #include <cstdint>
 #include <math.h>
 #include <stdio.h>
+#include <string>
 #include <utility>
 #include <vector>
 
 using namespace std;
 
-double debuging_estimate_harmonic_number(
-    int N, int k, double skew,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator start,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator end,
-    FILE *output);
-double estimate_harmonic_number(
-    int N, int k, double skew,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator start,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator end);
-double harmonic_number_variance(
-    int N, int k, double skew,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator start,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator end);
-double cost_topk_skew(
-    int N, int k, double skew_d,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator start,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator end);
-double cost_topk_skew_old(
-    int N, int k, double skew, double harmonic_n,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator start,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator end);
-double binary_search_estimate_skew(
-    int N, int k,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator start,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator end);
-
-double small_set_estimate_skew(
-    int N, int k,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator start,
-    std::vector<pair<std::array<char, FT_SIZE>, uint32_t>>::iterator end);
+// The estimators take the top-k counts from the largest down as an iterator
+// range over (key, count) pairs, i.e. `TopK::descending()` or the reverse of
+// `TopK::items()`. They are instantiated for those two iterator types.
+typedef vector<TopKItem>::reverse_iterator ItemsReverseIterator;
+
+/// How the sketches estimate the skew from their top-k.
+enum SkewEstimator {
+  // `small_set_estimate_skew`, the best of a grid of skews 0.5, 0.6, ... 1.5.
+  grid_skew_estimator = 0,
+  // `regression_estimate_skew`, a least squares fit of the counts' log-log
+  // rank plot.
+  regression_skew_estimator = 1,
+  // The same fit kept up to date by the top-k as it changes
+  // (`HeavyHitters::tracked_skew`), O(1) to read so the dynamic sketches
+  // reconsider their configuration on every packet.
+  incremental_skew_estimator = 2,
+};
+
+const int SKEW_ESTIMATOR_COUNT = 3;
+
+std::string skew_estimator_name(SkewEstimator estimator);
+// Parses the short names accepted on the command line (grid, regression,
+// incremental).
+SkewEstimator parse_skew_estimator(const char *name);
+
+// The skew of a top-k (out of `N` packets) with the chosen estimator.
+double estimate_topk_skew(SkewEstimator estimator, int N,
+                          HeavyHitters &top_k);
+
+template <class Iterator>
+double debuging_estimate_harmonic_number(int N, int k, double skew,
+                                         Iterator first, Iterator last,
+                                         FILE *output);
+template <class Iterator>
+double estimate_harmonic_number(int N, int k, double skew, Iterator first,
+                                Iterator last);
+template <class Iterator>
+double harmonic_number_variance(int N, int k, double skew, Iterator first,
+                                Iterator last);
+template <class Iterator>
+double cost_topk_skew(int N, int k, double skew_d, Iterator first,
+                      Iterator last);
+
+// The most skews `cost_topk_skews` evaluates at once.
+const int MAX_SKEW_CANDIDATES = 64;
+
+// `cost_topk_skew` for the `skew_count` skews first_skew, first_skew +
+// skew_step, ... written to `costs`, all in a single pass over the top-k.
+template <class Iterator>
+void cost_topk_skews(int N, int k, double first_skew, double skew_step,
+                     int skew_count, Iterator first, Iterator last,
+                     double *costs);
+template <class Iterator>
+double cost_topk_skew_old(int N, int k, double skew, double harmonic_n,
+                          Iterator first, Iterator last);
+template <class Iterator>
+double binary_search_estimate_skew(int N, int k, Iterator first,
+                                   Iterator last);
+
+template <class Iterator>
+double small_set_estimate_skew(int N, int k, Iterator first, Iterator last);
+
+/// The sums a least squares fit of log(count) against log(rank), weighted by
+/// the counts, needs.
+struct RegressionSums {
+  double w = 0.0;
+  double x = 0.0;
+  double y = 0.0;
+  double xx = 0.0;
+  double xy = 0.0;
+
+  // Adds the item at `rank` (from 1) with `count`, or removes it when `sign`
+  // is -1. Items with a count of 0 have no weight.
+  void add(int rank, uint32_t count, double log_count, double sign);
+  // Minus the slope of the fit clamped to 0, 0 when it is not defined.
+  double skew() const;
+};
+
+// Fits log(count) = c - skew * log(rank) by least squares weighted by the
+// counts, so the noisy tail of the top-k counts for less than the heavy
+// hitters. It is a single pass (the logs of the ranks are precomputed) and the
+// estimate is continuous rather than a grid point, negative fits are clamped
+// to 0.
+template <class Iterator>
+double regression_estimate_skew(int N, int k, Iterator first, Iterator last);
+
+/// Keeps `regression_estimate_skew` of a top-k up to date as its counts
+/// change, so that it can be read in O(1) at any packet.
+///
+/// The estimate does not depend on the keys, only the counts are kept (from
+/// the largest down). A count going from `old_count` to `new_count` replaces
+/// the first (or last) count of `old_count`'s tie group and moves past the
+/// counts in between, whose ranks change by one. In the common case of a count
+/// growing by 1 there are none, and only that one count's terms change.
+class IncrementalSkewEstimator {
+  vector<uint32_t> counts;
+  vector<double> log_counts;
+  RegressionSums sums;
+
+  // Adds (`sign` 1) or removes (`sign` -1) the terms of positions
+  // [first, last).
+  void add_range(int first, int last, double sign);
+
+public:
+  // A new item with `count`.
+  void insert(uint32_t count);
+  // An item's count changed, including an evicted item being replaced.
+  void change(uint32_t old_count, uint32_t new_count);
+
+  double skew() const { return sums.skew(); }
+};
@@ -0,0 +1,217 @@
+#include "stream_summary.hpp"
+
+#include "skew_estimation.hpp"
+
+StreamSummary::StreamSummary(int k) {
+  assert(k > 0 && "StreamSummary: k must be positive!");
+  this->k = k;
+  this->size = 0;
+
+  // At most half the slots are ever used, which keeps the probes short.
+  uint32_t slot_count = 4;
+  while (slot_count < 2 * (uint32_t)k) {
+    slot_count <<= 1;
+  }
+  slots.assign(slot_count, -1);
+  slot_mask = slot_count - 1;
+
+  entries.resize(k);
+
+  // There are at most k distinct counts, plus the bucket an increment creates
+  // before it frees the one it left.
+  buckets.resize(k + 1);
+  for (int i = 0; i <= k; i++) {
+    buckets[i].first = -1;
+    buckets[i].next = i < k ? i + 1 : -1;
+  }
+  free_buckets = 0;
+  min_bucket = -1;
+  max_bucket = -1;
+
+  sorted.reserve(k);
+  sorted_valid = true;
+}
+
+// The slot holding `key`, or the empty slot where it would be inserted.
+uint32_t StreamSummary::find_slot(const char *key, uint32_t hash) {
+  uint32_t slot = hash & slot_mask;
+  while (slots[slot] != -1) {
+    const Entry &entry = entries[slots[slot]];
+    if (entry.hash == hash && memcmp(entry.key.data(), key, FT_SIZE) == 0) {
+      break;
+    }
+    slot = (slot + 1) & slot_mask;
+  }
+  return slot;
+}
+
+// Empties `slot`, shifting back the entries after it like `TopK::remove_slot`.
+void StreamSummary::remove_slot(uint32_t slot) {
+  slots[slot] = -1;
+
+  uint32_t next = slot;
+  while (true) {
+    next = (next + 1) & slot_mask;
+    if (slots[next] == -1) {
+      return;
+    }
+
+    uint32_t home = entries[slots[next]].hash & slot_mask;
+    if (((next - home) & slot_mask) >= ((next - slot) & slot_mask)) {
+      slots[slot] = slots[next];
+      entries[slots[slot]].slot = slot;
+      slots[next] = -1;
+      slot = next;
+    }
+  }
+}
+
+// Takes a free bucket for `count` and links it after `after` (-1 for the front
+// of the list).
+int32_t StreamSummary::insert_bucket(uint32_t count, int32_t after) {
+  int32_t bucket = free_buckets;
+  assert(bucket != -1 && "StreamSummary: ran out of buckets!");
+  free_buckets = buckets[bucket].next;
+
+  int32_t next = after == -1 ? min_bucket : buckets[after].next;
+  buckets[bucket].count = count;
+  buckets[bucket].first = -1;
+  buckets[bucket].prev = after;
+  buckets[bucket].next = next;
+
+  if (after == -1) {
+    min_bucket = bucket;
+  } else {
+    buckets[after].next = bucket;
+  }
+  if (next == -1) {
+    max_bucket = bucket;
+  } else {
+    buckets[next].prev = bucket;
+  }
+  return bucket;
+}
+
+void StreamSummary::remove_bucket(int32_t bucket) {
+  int32_t prev = buckets[bucket].prev;
+  int32_t next = buckets[bucket].next;
+
+  if (prev == -1) {
+    min_bucket = next;
+  } else {
+    buckets[prev].next = next;
+  }
+  if (next == -1) {
+    max_bucket = prev;
+  } else {
+    buckets[next].prev = prev;
+  }
+
+  buckets[bucket].next = free_buckets;
+  free_buckets = bucket;
+}
+
+void StreamSummary::attach(int32_t entry, int32_t bucket) {
+  int32_t first = buckets[bucket].first;
+  entries[entry].bucket = bucket;
+  entries[entry].count = buckets[bucket].count;
+  entries[entry].prev = -1;
+  entries[entry].next = first;
+  if (first != -1) {
+    entries[first].prev = entry;
+  }
+  buckets[bucket].first = entry;
+}
+
+void StreamSummary::detach(int32_t entry) {
+  int32_t prev = entries[entry].prev;
+  int32_t next = entries[entry].next;
+
+  if (prev == -1) {
+    buckets[entries[entry].bucket].first = next;
+  } else {
+    entries[prev].next = next;
+  }
+  if (next != -1) {
+    entries[next].prev = prev;
+  }
+}
+
+// Moves `entry` to the bucket one count above its own.
+void StreamSummary::increment(int32_t entry) {
+  int32_t bucket = entries[entry].bucket;
+  uint32_t count = buckets[bucket].count + 1;
+  if (skew_tracker != nullptr) {
+    skew_tracker->change(count - 1, count);
+  }
+
+  detach(entry);
+  int32_t next = buckets[bucket].next;
+  if (next == -1 || buckets[next].count != count) {
+    next = insert_bucket(count, bucket);
+  }
+  attach(entry, next);
+
+  if (buckets[bucket].first == -1) {
+    remove_bucket(bucket);
+  }
+}
+
+void StreamSummary::update(const char *packet, uint32_t value) {
+  (void)value;
+  sorted_valid = false;
+
+  uint32_t hash = key_hash(packet);
+  uint32_t slot = find_slot(packet, hash);
+  int32_t entry = slots[slot];
+
+  if (entry != -1) {
+    increment(entry);
+    return;
+  }
+
+  if (size < k) {
+    entry = size++;
+    int32_t bucket = min_bucket;
+    if (bucket == -1 || buckets[bucket].count != 1) {
+      bucket = insert_bucket(1, -1);
+    }
+    attach(entry, bucket);
+    if (skew_tracker != nullptr) {
+      skew_tracker->insert(1);
+    }
+  } else {
+    // Replace a packet with the smallest count, the removal may shift the slot
+    // of the new key.
+    entry = buckets[min_bucket].first;
+    remove_slot(entries[entry].slot);
+    slot = find_slot(packet, hash);
+    increment(entry);
+  }
+
+  memcpy(entries[entry].key.data(), packet, FT_SIZE);
+  entries[entry].hash = hash;
+  entries[entry].slot = slot;
+  slots[slot] = entry;
+}
+
+vector<TopKItem> StreamSummary::items() {
+  descending();
+  return vector<TopKItem>(sorted.rbegin(), sorted.rend());
+}
+
+TopKView StreamSummary::descending() {
+  if (!sorted_valid) {
+    // `sorted` has capacity k so this never allocates.
+    sorted.clear();
+    for (int32_t bucket = max_bucket; bucket != -1;
+         bucket = buckets[bucket].prev) {
+      for (int32_t entry = buckets[bucket].first; entry != -1;
+           entry = entries[entry].next) {
+        sorted.push_back(make_pair(entries[entry].key, entries[entry].count));
+      }
+    }
+    sorted_valid = true;
+  }
+  return TopKView(sorted.begin(), sorted.end());
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "heavy_hitters.hpp"
+#include <assert.h>
+#include <string.h>
+
+// Space-Saving (Metwally et al., "Efficient Computation of Frequent and Top-k
+// Elements in Data Streams") over the Stream-Summary structure.
+//
+// Unlike `TopK`, which ranks packets by the value the sketch reports, it counts
+// the packets itself: `value` is ignored and each update adds one occurrence.
+// A packet that is not monitored replaces the one with the smallest count and
+// takes over that count plus one, so counts are overestimates by at most N / k.
+//
+// The monitored packets are grouped in buckets of equal count, kept in a list
+// in increasing count order, so an update moves its packet to the next bucket
+// in O(1). Like `TopK` all the memory is allocated by the constructor.
+class StreamSummary : public HeavyHitters {
+  struct Entry {
+    uint32_t count;
+    // The entry's slot in `slots` and the hash of its key.
+    uint32_t slot;
+    uint32_t hash;
+    // The entry's bucket and its neighbours in the bucket's list.
+    int32_t bucket;
+    int32_t prev;
+    int32_t next;
+    std::array<char, FT_SIZE> key;
+  };
+
+  struct Bucket {
+    uint32_t count;
+    // The first entry of the bucket, or -1 for an empty (free) bucket.
+    int32_t first;
+    // The neighbouring buckets in count order, `next` also links the free
+    // buckets together.
+    int32_t prev;
+    int32_t next;
+  };
+
+  vector<Entry> entries;
+  vector<Bucket> buckets;
+  int32_t free_buckets;
+  int32_t min_bucket;
+  int32_t max_bucket;
+
+  // The entry holding the key in each slot, or -1 for an empty slot.
+  vector<int32_t> slots;
+  uint32_t slot_mask;
+
+  // The items in descending count order, rebuilt (in place) by `descending`
+  // after an update changed them.
+  vector<TopKItem> sorted;
+  bool sorted_valid;
+
+  int k;
+  int size;
+
+  uint32_t find_slot(const char *key, uint32_t hash);
+  void remove_slot(uint32_t slot);
+
+  int32_t insert_bucket(uint32_t count, int32_t after);
+  void remove_bucket(int32_t bucket);
+  void attach(int32_t entry, int32_t bucket);
+  void detach(int32_t entry);
+  void increment(int32_t entry);
+
+public:
+  StreamSummary(int k);
+
+  void update(const char *packet, uint32_t value);
+
+  vector<TopKItem> items();
+  TopKView descending();
+};
@@ -1,37 +1,191 @@
 #include "topK.hpp"
 
-TopK::TopK(int k) { this->k = k; }
+#include <algorithm>
 
-vector<pair<std::array<char, FT_SIZE>, uint32_t>> TopK::items() {
-  vector<pair<std::array<char, FT_SIZE>, uint32_t>> kv;
-  for (auto it = inverse_kvm.begin(); it != inverse_kvm.end(); ++it) {
-    kv.push_back(make_pair(it->first.second, it->first.first));
+#include "skew_estimation.hpp"
+
+TopK::TopK(int k) {
+  assert(k > 0 && "TopK: k must be positive!");
+  this->k = k;
+  this->size = 0;
+
+  // At most half the slots are ever used, which keeps the probes short.
+  uint32_t slot_count = 4;
+  while (slot_count < 2 * (uint32_t)k) {
+    slot_count <<= 1;
+  }
+  slots.assign(slot_count, -1);
+  slot_mask = slot_count - 1;
+
+  heap.resize(k);
+
+  // With 8 cells per member a non-member passes the gate at most ~1/8 of the
+  // time.
+  filter.assign(8 * slot_count, 0);
+  filter_mask = 8 * slot_count - 1;
+
+  updates = 0;
+  gated_updates = 0;
+
+  sorted.reserve(k);
+  sorted_valid = true;
+}
+
+bool TopK::less(const Entry &a, const Entry &b) {
+  if (a.value != b.value) {
+    return a.value < b.value;
+  }
+  return a.key < b.key;
+}
+
+vector<TopKItem> TopK::items() {
+  descending();
+  return vector<TopKItem>(sorted.rbegin(), sorted.rend());
+}
+
+TopKView TopK::descending() {
+  if (!sorted_valid) {
+    // `sorted` has capacity k so this never allocates.
+    sorted.clear();
+    for (int i = 0; i < size; i++) {
+      sorted.push_back(make_pair(heap[i].key, heap[i].value));
+    }
+    sort(sorted.begin(), sorted.end(),
+         [](const TopKItem &a, const TopKItem &b) {
+           if (a.second != b.second) {
+             return a.second > b.second;
+           }
+           return a.first > b.first;
+         });
+    sorted_valid = true;
+  }
+  return TopKView(sorted.begin(), sorted.end());
+}
+
+// The slot holding `key`, or the empty slot where it would be inserted.
+uint32_t TopK::find_slot(const std::array<char, FT_SIZE> &key, uint32_t hash) {
+  uint32_t slot = hash & slot_mask;
+  while (slots[slot] != -1) {
+    const Entry &entry = heap[slots[slot]];
+    if (entry.hash == hash &&
+        memcmp(entry.key.data(), key.data(), FT_SIZE) == 0) {
+      break;
+    }
+    slot = (slot + 1) & slot_mask;
+  }
+  return slot;
+}
+
+// Empties `slot`, shifting back the entries after it (linear probing has no
+// tombstones) so they stay reachable from their home slot.
+void TopK::remove_slot(uint32_t slot) {
+  slots[slot] = -1;
+
+  uint32_t next = slot;
+  while (true) {
+    next = (next + 1) & slot_mask;
+    if (slots[next] == -1) {
+      return;
+    }
+
+    // The entry can move to the empty slot only if that lies between its home
+    // slot and where it currently is.
+    uint32_t home = heap[slots[next]].hash & slot_mask;
+    if (((next - home) & slot_mask) >= ((next - slot) & slot_mask)) {
+      slots[slot] = slots[next];
+      heap[slots[slot]].slot = slot;
+      slots[next] = -1;
+      slot = next;
+    }
+  }
+}
+
+void TopK::place(int position, const Entry &entry) {
+  heap[position] = entry;
+  slots[entry.slot] = position;
+}
+
+void TopK::sift_up(int position) {
+  Entry entry = heap[position];
+  while (position > 0) {
+    int parent = (position - 1) / 2;
+    if (!less(entry, heap[parent])) {
+      break;
+    }
+    place(position, heap[parent]);
+    position = parent;
   }
-  return kv;
+  place(position, entry);
+}
+
+void TopK::sift_down(int position) {
+  Entry entry = heap[position];
+  while (true) {
+    int child = 2 * position + 1;
+    if (child >= size) {
+      break;
+    }
+    if (child + 1 < size && less(heap[child + 1], heap[child])) {
+      child++;
+    }
+    if (!less(heap[child], entry)) {
+      break;
+    }
+    place(position, heap[child]);
+    position = child;
+  }
+  place(position, entry);
 }
 
 void TopK::update(const char *packet, uint32_t value) {
-  std::array<char, FT_SIZE> key;
-  memcpy(&key, packet, FT_SIZE);
+  updates++;
+  uint32_t hash = key_hash(packet);
+
+  // A packet that is not a member needs more than the minimum to get in.
+  if (size == k && value <= heap[0].value && filter[filter_cell(hash)] == 0) {
+    gated_updates++;
+    return;
+  }
 
-  bool key_in_map = (kvm.find(key) == kvm.end()) ? false : true;
+  Entry entry;
+  memcpy(entry.key.data(), packet, FT_SIZE);
+  entry.hash = hash;
+  entry.value = value;
+  sorted_valid = false;
 
-  if (!key_in_map && kvm.size() == k) {
-    uint32_t min_val = (inverse_kvm.begin()->first).first;
-    std::array<char, FT_SIZE> min_val_key = (inverse_kvm.begin()->first).second;
+  uint32_t slot = find_slot(entry.key, entry.hash);
+  int position = slots[slot];
 
-    if (value > min_val) {
-      kvm.erase(min_val_key);
-      inverse_kvm.erase(make_pair(min_val, min_val_key));
-      kvm[key] = value;
-      inverse_kvm[make_pair(value, key)] = key;
+  if (position != -1) {
+    uint32_t old_value = heap[position].value;
+    heap[position].value = value;
+    if (skew_tracker != nullptr) {
+      skew_tracker->change(old_value, value);
+    }
+    if (value < old_value) {
+      sift_up(position);
+    } else if (value > old_value) {
+      sift_down(position);
+    }
+  } else if (size < k) {
+    entry.slot = slot;
+    filter[filter_cell(hash)]++;
+    if (skew_tracker != nullptr) {
+      skew_tracker->insert(value);
     }
-  } else if (key_in_map || kvm.size() < k) {
-    if (key_in_map) {
-      inverse_kvm.erase(
-          pair<uint32_t, std::array<char, FT_SIZE>>(kvm[key], key));
+    place(size, entry);
+    size++;
+    sift_up(size - 1);
+  } else if (value > heap[0].value) {
+    // Evict the smallest item, the removal may shift the slot of the new key.
+    if (skew_tracker != nullptr) {
+      skew_tracker->change(heap[0].value, value);
     }
-    inverse_kvm[pair<uint32_t, std::array<char, FT_SIZE>>(value, key)] = key;
-    kvm[key] = value;
+    remove_slot(heap[0].slot);
+    filter[filter_cell(heap[0].hash)]--;
+    filter[filter_cell(hash)]++;
+    entry.slot = find_slot(entry.key, entry.hash);
+    place(0, entry);
+    sift_down(0);
   }
 }
@@ -3,29 +3,76 @@
 
 #pragma once
 
-#include "ArrayHasher.hpp"
-#include "Defs.hpp"
+#include "heavy_hitters.hpp"
 #include <assert.h>
-#include <map>
-#include <stdint.h>
 #include <string.h>
-#include <unordered_map>
-#include <vector>
-
-using namespace std;
 
 // Adapted from SALSA (https://github.com/SALSA-ICDE2021/SALSA/tree/main/Salsa).
-class TopK {
-  unordered_map<std::array<char, FT_SIZE>, uint32_t, ArrayHasher> kvm;
-  map<pair<uint32_t, std::array<char, FT_SIZE>>, std::array<char, FT_SIZE>>
-      inverse_kvm;
+//
+// The k items are kept in a min-heap ordered by (value, key), so the item
+// evicted is the same one the original std::map based version evicted, and
+// found through an open addressing index over the keys. All the memory is
+// allocated by the constructor, `update` never allocates.
+//
+// Once full most updates (under skewed traffic) are for packets below the
+// k-th value that are not members, which cannot change the top-k. They are
+// rejected by an admission gate: the heap minimum plus a counting filter of
+// the members' key hashes, before the key is copied or the index probed.
+class TopK : public HeavyHitters {
+  struct Entry {
+    uint32_t value;
+    // The entry's slot in `slots` and the hash of its key.
+    uint32_t slot;
+    uint32_t hash;
+    std::array<char, FT_SIZE> key;
+  };
+
+  // heap[0 .. size) is a min-heap.
+  vector<Entry> heap;
+  // The heap position of the key in each slot, or -1 for an empty slot.
+  vector<int32_t> slots;
+  uint32_t slot_mask;
+
+  // The number of members whose key hash falls in each filter cell.
+  vector<uint16_t> filter;
+  uint32_t filter_mask;
+
+  uint64_t updates;
+  uint64_t gated_updates;
+
+  // The items in descending (value, key) order, rebuilt (in place) by
+  // `descending` after an update changed them.
+  vector<TopKItem> sorted;
+  bool sorted_valid;
 
   int k;
+  int size;
+
+  static bool less(const Entry &a, const Entry &b);
+  // The index slots use the low bits of the hash, the filter starts from the
+  // high ones.
+  uint32_t filter_cell(uint32_t hash) {
+    return ((hash >> 16) | (hash << 16)) & filter_mask;
+  }
+
+  uint32_t find_slot(const std::array<char, FT_SIZE> &key, uint32_t hash);
+  void remove_slot(uint32_t slot);
+  void place(int position, const Entry &entry);
+  void sift_up(int position);
+  void sift_down(int position);
 
 public:
   TopK(int k);
 
-  vector<pair<std::array<char, FT_SIZE>, uint32_t>> items();
+  // A copy of the items in ascending (value, key) order.
+  vector<TopKItem> items();
+  // The items in descending (value, key) order without copying them out.
+  TopKView descending();
 
   void update(const char *packet, uint32_t value);
+
+  // How many updates there have been, and how many the admission gate
+  // rejected.
+  uint64_t update_count() { return updates; }
+  uint64_t gated_update_count() { return gated_updates; }
 };
@@ -1,8 +1,10 @@
 #pragma once
 
 #include <array>
+#include <map>
 #include <math.h>
 #include <stdio.h>
+#include <utility>
 
 const int SKEW_START = 13;
 // const int SKEW_START = 6;
@@ -11,7 +13,9 @@ const int SKEW_END = 13;
 const int SKEW_COUNT = SKEW_END - SKEW_START + 1;
 const long HARMONIC_TABLE_DOMAIN = 1 << 26;
 
-constexpr double calculate_harmonic_number(long n, double skew) {
+// The exact sum, 1 / i^skew for i = 1 to n. Slow (n calls to pow) and, for
+// large n, less accurate than `harmonic_number`, kept as a reference.
+double calculate_harmonic_number(long n, double skew) {
   double acc = 0.0;
   for (long i = 1; i <= n; i++) {
     acc += 1.0 / pow((double)i, skew);
@@ -34,39 +38,85 @@ double calculate_harmonic_number_debug(long n, double skew) {
   return acc;
 }
 
-constexpr std::array<double, SKEW_COUNT> build_harmonic_number_table() {
-  std::array<double, SKEW_COUNT> table{};
-  int i = 0;
-  for (int skew = SKEW_START; skew <= SKEW_END; skew++) {
-    double harmonic_n =
-        calculate_harmonic_number(HARMONIC_TABLE_DOMAIN, 0.1 * (double)skew);
-    table[i] = harmonic_n;
-    i++;
-  }
+// The terms summed directly by `harmonic_number`, the Euler-Maclaurin tail
+// starts after them.
+const long HARMONIC_DIRECT_TERMS = 32;
 
-  return table;
-}
+// B_2j / (2j)! for j = 1 to 5.
+const double EULER_MACLAURIN_COEFFICIENTS[] = {
+    1.0 / 12.0, -1.0 / 720.0, 1.0 / 30240.0, -1.0 / 1209600.0,
+    1.0 / 47900160.0};
 
-const std::array<double, SKEW_COUNT> CONST_HARMONIC_TABLE =
-    build_harmonic_number_table();
+// The generalized harmonic number H(n, skew) = sum of 1 / i^skew for i = 1 to
+// n, to ~1e-12 relative precision in O(1): the first HARMONIC_DIRECT_TERMS
+// terms are summed and the rest comes from the Euler-Maclaurin formula with
+// five correction terms (whose remainder is below 1e-18 from i = 33 on).
+double harmonic_number(long n, double skew) {
+  double acc = 0.0;
+  long direct = n < HARMONIC_DIRECT_TERMS ? n : HARMONIC_DIRECT_TERMS;
+  for (long i = direct; i >= 1; i--) {
+    acc += pow((double)i, -skew);
+  }
+  if (n <= HARMONIC_DIRECT_TERMS) {
+    return acc;
+  }
 
-double get_harmonic_number_or_calc(long n, int skew) {
-  double skew_d = 0.1 * (double)skew;
+  // The sum of f(x) = x^-skew over [a, n].
+  double a = (double)(HARMONIC_DIRECT_TERMS + 1);
+  double b = (double)n;
+  double log_a = log(a);
+  double log_b = log(b);
 
-  if (skew >= SKEW_START && skew <= SKEW_END && n == HARMONIC_TABLE_DOMAIN) {
-    int table_i = skew - SKEW_START;
-    printf("using cached harmonic number\n");
-    return CONST_HARMONIC_TABLE[table_i];
+  // The integral (b^(1 - skew) - a^(1 - skew)) / (1 - skew), written with
+  // expm1 so it stays accurate as skew approaches 1.
+  double t = 1.0 - skew;
+  double integral;
+  if (t == 0.0) {
+    integral = log_b - log_a;
   } else {
-    printf("calculating harmonic number\n");
-    return calculate_harmonic_number(n, skew_d);
+    integral = exp(t * log_a) * expm1(t * (log_b - log_a)) / t;
   }
+  acc += integral + 0.5 * (pow(a, -skew) + pow(b, -skew));
+
+  // f^(2j - 1)(x) = -skew (skew + 1) ... (skew + 2j - 2) x^(-skew - 2j + 1).
+  double rising = skew;
+  double a_power = pow(a, -skew - 1.0);
+  double b_power = pow(b, -skew - 1.0);
+  for (int j = 0; j < 5; j++) {
+    acc += EULER_MACLAURIN_COEFFICIENTS[j] * -rising * (b_power - a_power);
+
+    rising *= (skew + 2 * j + 1) * (skew + 2 * j + 2);
+    a_power /= a * a;
+    b_power /= b * b;
+  }
+
+  return acc;
+}
+
+// `harmonic_number` remembering the (n, skew) pairs it has been asked for.
+double cached_harmonic_number(long n, double skew) {
+  static std::map<std::pair<long, double>, double> cache;
+
+  auto key = std::make_pair(n, skew);
+  auto it = cache.find(key);
+  if (it != cache.end()) {
+    return it->second;
+  }
+
+  double harmonic_n = harmonic_number(n, skew);
+  cache[key] = harmonic_n;
+  return harmonic_n;
+}
+
+double get_harmonic_number_or_calc(long n, int skew) {
+  return cached_harmonic_number(n, 0.1 * (double)skew);
 }
 
 void print_cached_skews() {
   for (int i = 0; i < SKEW_COUNT; i++) {
     double skew = 0.1 * (double)(SKEW_START + i);
-    double harmonic_n = CONST_HARMONIC_TABLE[i];
+    double harmonic_n = get_harmonic_number_or_calc(HARMONIC_TABLE_DOMAIN,
+                                                    SKEW_START + i);
     printf("For skew %f, cached harmonic number: %f\n", skew, harmonic_n);
   }
 }